@@ -12,11 +12,11 @@
  */
 class SimpleLSDatapoint : public Datapoint {
 public:
-    std::vector<double> weights;
-    std::vector<int> coordinates;
+    DatapointWeights weights;
+    DatapointCoordinates coordinates;
     double label;
 
-    SimpleLSDatapoint(const std::string &input_line, int order) : Datapoint(input_line, order) {
+    SimpleLSDatapoint(const std::string &input_line, DatapointIndex order) : Datapoint(input_line, order) {
 	// Create a string stream from the input line.
 	// This lets us read from the line as if reading via cin.
 	std::stringstream in(input_line);
@@ -37,17 +37,33 @@ public:
 	in >> label;
     }
 
-    std::vector<double> & GetWeights() override {
+    // Copy of other, with its weights and coordinates allocated from region
+    // (see CopyTo).
+    SimpleLSDatapoint(const SimpleLSDatapoint &other, DatapointRegion *region) : Datapoint(other),
+	weights(other.weights, DatapointAllocator<double>(region)),
+	coordinates(other.coordinates, DatapointAllocator<int>(region)),
+	label(other.label) {}
+
+    DatapointWeights & GetWeights() override {
 	return weights;
     }
 
-    std::vector<int> & GetCoordinates() override {
+    DatapointCoordinates & GetCoordinates() override {
 	return coordinates;
     }
 
     int GetNumCoordinateTouches() override {
 	return coordinates.size();
     }
+
+    // Let --relocate_datapoints copy the datapoint into a thread's arena.
+    size_t ObjectSize() override {
+	return sizeof(SimpleLSDatapoint);
+    }
+
+    Datapoint * CopyTo(void *memory, DatapointRegion *region) override {
+	return new (memory) SimpleLSDatapoint(*this, region);
+    }
 };
 
 /* Minimize the equation sum (a_i x - b_i)^2
@@ -62,7 +78,7 @@ public:
  */
 class SimpleLSModel : public Model {
 private:
-    double dot(SimpleLSDatapoint *a_i, std::vector<double> &x) {
+    double dot(SimpleLSDatapoint *a_i, ModelVector &x) {
 	double product = 0;
 	for (int i = 0; i < a_i->GetNumCoordinateTouches(); i++) {
 	    int index = a_i->GetCoordinates()[i];
@@ -73,7 +89,7 @@ private:
     }
 
 public:
-    std::vector<double> x;
+    ModelVector x;
 
     SimpleLSModel(const std::string &input_line) {
 	// Create a string stream from the input line.
@@ -99,7 +115,7 @@ public:
 	// Note that ComputeLoss is called by a SINGLE thread.
 	// It is possible to parallelize this via
 	// #pragma omp parallel for
-	for (int i = 0; i < datapoints.size(); i++) {
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
 	    SimpleLSDatapoint *a_i = (SimpleLSDatapoint *)datapoints[i];
 	    double b_i = a_i->label;
 	    double dot_product = dot(a_i, x);
@@ -124,21 +140,27 @@ public:
 	return 1;
     }
 
-    std::vector<double> &ModelData() override {
+    ModelVector & ModelData() override {
 	return x;
     }
 
-    void Lambda(int coordinate, double &out, std::vector<double> &local_model) override {
+    void Lambda(int coordinate, double &out, ModelVector &local_model) override {
 	out = 0;
     }
 
-    void Kappa(int coordinate, std::vector<double> &out, std::vector<double> &local_model) override {
+    void Kappa(int coordinate, std::vector<double> &out, ModelVector &local_model) override {
 	out[0] = 0;
     }
 
+    // h_bar_j(x) = 2(a_i * x - b_i) a_ij is a scalar times the weights of a_i,
+    // which lets updaters (e.g: SAGA) store just that scalar per data point.
+    bool HasScalarGradient() override {
+	return true;
+    }
+
     // h_bar_j(x) = 2(a_i * x - b_i) a_i
     // We can just precompute the each h_bar_j directly.
-    void PrecomputeCoefficients(Datapoint *datapoint, Gradient *g, std::vector<double> &local_model) override {
+    void PrecomputeCoefficients(Datapoint *datapoint, Gradient *g, ModelVector &local_model) override {
 	// We need to make sure g->coeffs can store the gradient to the model.
 	if (g->coeffs.size() != 1) g->coeffs.resize(NumParameters());
 
@@ -146,6 +168,7 @@ public:
 	SimpleLSDatapoint *a_i = (SimpleLSDatapoint *)datapoint;
 	double b_i = a_i->label;
 	double coefficient = 2 * (dot(a_i, local_model) - b_i);
+	g->scalar_coeff = coefficient;
 
 	// For each nnz weight of the data point, set g->coeffs appropriately.
 	for (int i = 0; i < datapoint->GetNumCoordinateTouches(); i++) {
@@ -157,7 +180,7 @@ public:
 
     // Since g->coeffs[0] = 2(a_i * x - b_i),
     // The gradient is g->coeffs[0] * a_ij (i'th datapoint, j'th
-    void H_bar(int coordinate, std::vector<double> &out, Gradient *g, std::vector<double> &local_model) override {
+    void H_bar(int coordinate, std::vector<double> &out, Gradient *g, ModelVector &local_model) override {
 	out[0] = g->coeffs[coordinate];
     }
 };
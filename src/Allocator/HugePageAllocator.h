@@ -0,0 +1,216 @@
+/*
+* Copyright 2016 [See AUTHORS file for list of authors]
+*
+*    Licensed under the Apache License, Version 2.0 (the "License");
+*    you may not use this file except in compliance with the License.
+*    You may obtain a copy of the License at
+*
+*        http://www.apache.org/licenses/LICENSE-2.0
+*
+*    Unless required by applicable law or agreed to in writing, software
+*    distributed under the License is distributed on an "AS IS" BASIS,
+*    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*    See the License for the specific language governing permissions and
+*    limitations under the License.
+*/
+
+#ifndef _HUGE_PAGE_ALLOCATOR_
+#define _HUGE_PAGE_ALLOCATOR_
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+DEFINE_string(huge_pages, "transparent", "Pages to back the model and large updater arrays with: none, transparent (madvise) or explicit (MAP_HUGETLB, which needs reserved huge pages). Falls back to the next option when unavailable.");
+DEFINE_bool(print_page_size, false, "Should print the page size actually backing the model.");
+
+// Allocation of large arrays (e.g: the model), cache line aligned and backed
+// by huge pages where possible, to cut TLB misses of random row accesses.
+//
+// Arrays of at least HUGE_PAGE_SIZE are mapped separately, 2MB aligned:
+// - explicit: MAP_HUGETLB, if huge pages are reserved (vm.nr_hugepages).
+// - transparent: madvise(MADV_HUGEPAGE), if transparent huge pages are
+//   enabled (in madvise or always mode).
+// - none, or if neither is available: regular pages.
+// Smaller arrays are just cache line aligned.
+class HugePages {
+ private:
+    enum Kind { ALIGNED, MAPPED };
+    struct Allocation {
+	Kind kind;
+	size_t size;
+    };
+
+    static std::mutex &Lock() {
+	static std::mutex lock;
+	return lock;
+    }
+
+    static std::map<void *, Allocation> &Allocations() {
+	static std::map<void *, Allocation> allocations;
+	return allocations;
+    }
+
+    static void Record(void *data, Kind kind, size_t size) {
+	std::lock_guard<std::mutex> guard(Lock());
+	Allocations()[data] = {kind, size};
+    }
+
+    // Map size bytes (a multiple of HUGE_PAGE_SIZE) at a 2MB aligned address.
+    static void *MapAligned(size_t size) {
+	size_t padded_size = size + HUGE_PAGE_SIZE;
+	void *mapping = mmap(NULL, padded_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED) {
+	    return NULL;
+	}
+	char *start = (char *)mapping;
+	char *data = (char *)(((size_t)start + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+	if (data != start) {
+	    munmap(start, data - start);
+	}
+	char *end = data + size;
+	if (end != start + padded_size) {
+	    munmap(end, start + padded_size - end);
+	}
+	return data;
+    }
+
+ public:
+    static void *Allocate(size_t bytes) {
+	if (bytes >= HUGE_PAGE_SIZE && FLAGS_huge_pages != "none") {
+	    size_t size = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+#ifdef MAP_HUGETLB
+	    if (FLAGS_huge_pages == "explicit") {
+		void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (data != MAP_FAILED) {
+		    Record(data, MAPPED, size);
+		    return data;
+		}
+	    }
+#endif
+	    void *data = MapAligned(size);
+	    if (data != NULL) {
+#ifdef MADV_HUGEPAGE
+		madvise(data, size, MADV_HUGEPAGE);
+#endif
+		Record(data, MAPPED, size);
+		return data;
+	    }
+	}
+	void *data = NULL;
+	if (posix_memalign(&data, CACHE_LINE_SIZE, bytes == 0 ? CACHE_LINE_SIZE : bytes) != 0) {
+	    throw std::bad_alloc();
+	}
+	Record(data, ALIGNED, bytes);
+	return data;
+    }
+
+    static void Free(void *data) {
+	Allocation allocation;
+	{
+	    std::lock_guard<std::mutex> guard(Lock());
+	    std::map<void *, Allocation>::iterator it = Allocations().find(data);
+	    if (it == Allocations().end()) {
+		return;
+	    }
+	    allocation = it->second;
+	    Allocations().erase(it);
+	}
+	if (allocation.kind == MAPPED) {
+	    munmap(data, allocation.size);
+	}
+	else {
+	    free(data);
+	}
+    }
+
+    // Describe the pages actually backing the memory at data (touched pages
+    // only), from the kernel's view of its mapping in /proc/self/smaps.
+    static std::string DescribePages(const void *data) {
+	std::ifstream smaps("/proc/self/smaps");
+	std::string line;
+	size_t address = (size_t)data;
+	bool in_mapping = false;
+	std::string kernel_page_size = "", anon_huge_pages = "";
+	while (std::getline(smaps, line)) {
+	    size_t start, end;
+	    char dash;
+	    std::stringstream header(line);
+	    if (line.find(':') > line.find(' ') && header >> std::hex >> start >> dash >> end && dash == '-') {
+		in_mapping = start <= address && address < end;
+		continue;
+	    }
+	    if (!in_mapping) continue;
+	    if (line.compare(0, 15, "KernelPageSize:") == 0) {
+		kernel_page_size = line.substr(15);
+	    }
+	    else if (line.compare(0, 14, "AnonHugePages:") == 0) {
+		anon_huge_pages = line.substr(14);
+	    }
+	}
+	if (kernel_page_size == "") {
+	    return "unknown (no /proc/self/smaps)";
+	}
+	std::stringstream description;
+	description << "page size " << kernel_page_size.substr(kernel_page_size.find_first_not_of(' '));
+	if (anon_huge_pages != "") {
+	    description << ", in transparent huge pages: " << anon_huge_pages.substr(anon_huge_pages.find_first_not_of(' '));
+	}
+	return description.str();
+    }
+};
+
+// STL allocator through HugePages.
+template <class T>
+class HugePageAllocator {
+ public:
+    typedef T value_type;
+
+    HugePageAllocator() {}
+    template <class U>
+    HugePageAllocator(const HugePageAllocator<U> &other) {}
+
+    T *allocate(size_t n) {
+	return (T *)HugePages::Allocate(n * sizeof(T));
+    }
+
+    void deallocate(T *data, size_t n) {
+	HugePages::Free(data);
+    }
+
+    template <class U>
+    struct rebind {
+	typedef HugePageAllocator<U> other;
+    };
+
+    template <class U>
+    bool operator==(const HugePageAllocator<U> &other) const {
+	return true;
+    }
+
+    template <class U>
+    bool operator!=(const HugePageAllocator<U> &other) const {
+	return false;
+    }
+};
+
+// Vector for the model and model sized updater arrays.
+typedef std::vector<double, HugePageAllocator<double> > ModelVector;
+
+#endif
@@ -17,34 +17,57 @@
 #ifndef _DATAPOINT_
 #define _DATAPOINT_
 
+#include <new>
+#include "DatapointAllocator.h"
+#include "DatapointIndex.h"
+
 class Datapoint {
  private:
-    int order;
+    DatapointIndex order;
  public:
     Datapoint() {}
-    Datapoint(const std::string &input_line, int order) {
+    Datapoint(const std::string &input_line, DatapointIndex order) {
 	this->order = order;
     }
     virtual ~Datapoint() {}
 
     // Get labels corresponding to the corresponding coordinates of GetCoordinates().
-    virtual std::vector<double> & GetWeights() = 0;
+    virtual DatapointWeights & GetWeights() = 0;
 
     // Get coordinates corresponding to labels of GetWeights().
-    virtual std::vector<int> & GetCoordinates() = 0;
+    virtual DatapointCoordinates & GetCoordinates() = 0;
 
     // Get number of coordinates accessed by the datapoint.
     virtual int GetNumCoordinateTouches() = 0;
 
     // Set order of the datapoint.
-    virtual void SetOrder(int order) {
+    virtual void SetOrder(DatapointIndex order) {
 	this->order = order;
     }
 
     // Get the order of a datapoint (equivalent to id).
-    virtual int GetOrder() {
+    virtual DatapointIndex GetOrder() {
 	return order;
     }
+
+    // Relabel coordinate c as labels[c] (see CoordinateOrdering).
+    virtual void RelabelCoordinates(const std::vector<int> &labels) {
+	for (auto &coordinate : GetCoordinates()) {
+	    coordinate = labels[coordinate];
+	}
+    }
+
+    // Size of the object, and copy it into memory (of at least that size,
+    // suitably aligned), with its coordinates and weights allocated from
+    // region, e.g: to relocate it into a thread's arena.
+    // Datapoints that don't override these are not relocated.
+    virtual size_t ObjectSize() {
+	return 0;
+    }
+
+    virtual Datapoint * CopyTo(void *memory, DatapointRegion *region) {
+	return NULL;
+    }
 };
 
 #endif
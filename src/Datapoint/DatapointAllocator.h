@@ -0,0 +1,99 @@
+/*
+* Copyright 2016 [See AUTHORS file for list of authors]
+*
+*    Licensed under the Apache License, Version 2.0 (the "License");
+*    you may not use this file except in compliance with the License.
+*    You may obtain a copy of the License at
+*
+*        http://www.apache.org/licenses/LICENSE-2.0
+*
+*    Unless required by applicable law or agreed to in writing, software
+*    distributed under the License is distributed on an "AS IS" BASIS,
+*    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*    See the License for the specific language governing permissions and
+*    limitations under the License.
+*/
+
+#ifndef _DATAPOINT_ALLOCATOR_
+#define _DATAPOINT_ALLOCATOR_
+
+#include <stddef.h>
+#include <new>
+#include <vector>
+
+// A block of memory the coordinates and weights of datapoints are carved
+// out of, back to back (see DatapointArena). Does not own the memory.
+class DatapointRegion {
+ private:
+    char *start, *cursor, *end;
+
+ public:
+    static size_t Aligned(size_t size) {
+	return (size + alignof(max_align_t) - 1) / alignof(max_align_t) * alignof(max_align_t);
+    }
+
+    DatapointRegion() : start(NULL), cursor(NULL), end(NULL) {}
+
+    void Reset(char *memory, size_t size) {
+	start = cursor = memory;
+	end = memory + size;
+    }
+
+    // NULL if the region is full.
+    void *Allocate(size_t size) {
+	size = Aligned(size);
+	if (end - cursor < (ptrdiff_t)size) return NULL;
+	void *allocation = cursor;
+	cursor += size;
+	return allocation;
+    }
+
+    bool Owns(const void *pointer) const {
+	return pointer >= start && pointer < end;
+    }
+};
+
+// Allocator of the coordinates and weights of datapoints: from a region if
+// given one (the memory is then released along with the region), else from
+// the heap.
+template <class T>
+class DatapointAllocator {
+ public:
+    typedef T value_type;
+
+    DatapointRegion *region;
+
+    DatapointAllocator() : region(NULL) {}
+    explicit DatapointAllocator(DatapointRegion *region) : region(region) {}
+    template <class U>
+    DatapointAllocator(const DatapointAllocator<U> &other) : region(other.region) {}
+
+    T *allocate(size_t n) {
+	void *allocation = region ? region->Allocate(n * sizeof(T)) : NULL;
+	if (allocation == NULL) {
+	    allocation = ::operator new(n * sizeof(T));
+	}
+	return static_cast<T *>(allocation);
+    }
+
+    void deallocate(T *pointer, size_t n) {
+	if (region == NULL || !region->Owns(pointer)) {
+	    ::operator delete(pointer);
+	}
+    }
+
+    template <class U>
+    bool operator==(const DatapointAllocator<U> &other) const {
+	return region == other.region;
+    }
+
+    template <class U>
+    bool operator!=(const DatapointAllocator<U> &other) const {
+	return region != other.region;
+    }
+};
+
+typedef std::vector<int, DatapointAllocator<int> > DatapointCoordinates;
+typedef std::vector<double, DatapointAllocator<double> > DatapointWeights;
+
+#endif
@@ -0,0 +1,35 @@
+/*
+* Copyright 2016 [See AUTHORS file for list of authors]
+*
+*    Licensed under the Apache License, Version 2.0 (the "License");
+*    you may not use this file except in compliance with the License.
+*    You may obtain a copy of the License at
+*
+*        http://www.apache.org/licenses/LICENSE-2.0
+*
+*    Unless required by applicable law or agreed to in writing, software
+*    distributed under the License is distributed on an "AS IS" BASIS,
+*    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*    See the License for the specific language governing permissions and
+*    limitations under the License.
+*/
+
+#ifndef _DATAPOINT_INDEX_
+#define _DATAPOINT_INDEX_
+
+#include <stdint.h>
+
+// Type of datapoint orders (ids), and of counts and positions of datapoints
+// and of coordinate accesses over the whole dataset.
+//
+// 32 bit by default, so that the arrays of them (e.g: the datapoint ids of
+// DatapointPartitions, bookkeeping) stay dense. Build with INDEX_64 defined
+// (cmake -DINDEX_64=ON) for datasets with 2^31 or more datapoints or nonzeros.
+// Coordinates remain int: they are bounded by the size of the model.
+#ifdef INDEX_64
+typedef int64_t DatapointIndex;
+#else
+typedef int32_t DatapointIndex;
+#endif
+
+#endif
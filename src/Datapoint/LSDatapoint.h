@@ -23,8 +23,8 @@
 
 class LSDatapoint : public Datapoint {
  private:
-    std::vector<double> weights;
-    std::vector<int> coordinates;
+    DatapointWeights weights;
+    DatapointCoordinates coordinates;
 
     void Initialize(const std::string &input_line) {
 
@@ -49,22 +49,36 @@ class LSDatapoint : public Datapoint {
  public:
     int row;
 
-    LSDatapoint(const std::string &input_line, int order) : Datapoint(input_line, order) {
+    LSDatapoint(const std::string &input_line, DatapointIndex order) : Datapoint(input_line, order) {
 	Initialize(input_line);
     }
     ~LSDatapoint() {}
 
-    std::vector<double> & GetWeights() override {
+    // Copy of other, with its coordinates and weights allocated from region.
+    LSDatapoint(const LSDatapoint &other, DatapointRegion *region) : Datapoint(other),
+	weights(other.weights, DatapointAllocator<double>(region)),
+	coordinates(other.coordinates, DatapointAllocator<int>(region)),
+	row(other.row) {}
+
+    DatapointWeights & GetWeights() override {
 	return weights;
     }
 
-    std::vector<int> & GetCoordinates() override {
+    DatapointCoordinates & GetCoordinates() override {
 	return coordinates;
     }
 
     int GetNumCoordinateTouches() override {
 	return coordinates.size();
     }
+
+    size_t ObjectSize() override {
+	return sizeof(LSDatapoint);
+    }
+
+    Datapoint * CopyTo(void *memory, DatapointRegion *region) override {
+	return new (memory) LSDatapoint(*this, region);
+    }
 };
 
 #endif
@@ -24,8 +24,8 @@
 class MCDatapoint : public Datapoint {
  private:
     double label;
-    std::vector<double> weights;
-    std::vector<int> coordinates;
+    DatapointWeights weights;
+    DatapointCoordinates coordinates;
 
     void Initialize(const std::string &input_line) {
 	// Allocate data for coordiantes / weights.
@@ -40,26 +40,39 @@ class MCDatapoint : public Datapoint {
 
  public:
 
-    MCDatapoint(const std::string &input_line, int order) : Datapoint(input_line, order) {
+    MCDatapoint(const std::string &input_line, DatapointIndex order) : Datapoint(input_line, order) {
 	Initialize(input_line);
     }
     ~MCDatapoint() {}
 
+    // Copy of other, with its coordinates and weights allocated from region.
+    MCDatapoint(const MCDatapoint &other, DatapointRegion *region) : Datapoint(other), label(other.label),
+	weights(other.weights, DatapointAllocator<double>(region)),
+	coordinates(other.coordinates, DatapointAllocator<int>(region)) {}
+
     void OffsetMovieCoord(int offset) {
 	coordinates[1] += offset;
     }
 
-    std::vector<double> & GetWeights() override {
+    DatapointWeights & GetWeights() override {
 	return weights;
     }
 
-    std::vector<int> & GetCoordinates() override {
+    DatapointCoordinates & GetCoordinates() override {
 	return coordinates;
     }
 
     int GetNumCoordinateTouches() override {
 	return 2;
     }
+
+    size_t ObjectSize() override {
+	return sizeof(MCDatapoint);
+    }
+
+    Datapoint * CopyTo(void *memory, DatapointRegion *region) override {
+	return new (memory) MCDatapoint(*this, region);
+    }
 };
 
 #endif
@@ -20,8 +20,8 @@
 class MatrixInverseDatapoint : public Datapoint {
  private:
     int row;
-    std::vector<double> weights;
-    std::vector<int> coordinates;
+    DatapointWeights weights;
+    DatapointCoordinates coordinates;
 
     void Initialize(const std::string &input_line) {
 
@@ -47,22 +47,45 @@ class MatrixInverseDatapoint : public Datapoint {
  public:
     std::map<int, double> coordinate_weight_map;
 
-    MatrixInverseDatapoint(const std::string &input_line, int order) : Datapoint(input_line, order) {
+    MatrixInverseDatapoint(const std::string &input_line, DatapointIndex order) : Datapoint(input_line, order) {
 	Initialize(input_line);
     }
     ~MatrixInverseDatapoint() {}
 
-    std::vector<double> & GetWeights() override {
+    // Copy of other, with its coordinates and weights allocated from region.
+    MatrixInverseDatapoint(const MatrixInverseDatapoint &other, DatapointRegion *region) : Datapoint(other), row(other.row),
+	weights(other.weights, DatapointAllocator<double>(region)),
+	coordinates(other.coordinates, DatapointAllocator<int>(region)),
+	coordinate_weight_map(other.coordinate_weight_map) {}
+
+    DatapointWeights & GetWeights() override {
 	return weights;
     }
 
-    std::vector<int> & GetCoordinates() override {
+    DatapointCoordinates & GetCoordinates() override {
 	return coordinates;
     }
 
     int GetNumCoordinateTouches() override {
 	return coordinates.size();
     }
+
+    void RelabelCoordinates(const std::vector<int> &labels) override {
+	Datapoint::RelabelCoordinates(labels);
+	std::map<int, double> relabeled_map;
+	for (auto const & m_w : coordinate_weight_map) {
+	    relabeled_map[labels[m_w.first]] = m_w.second;
+	}
+	coordinate_weight_map.swap(relabeled_map);
+    }
+
+    size_t ObjectSize() override {
+	return sizeof(MatrixInverseDatapoint);
+    }
+
+    Datapoint * CopyTo(void *memory, DatapointRegion *region) override {
+	return new (memory) MatrixInverseDatapoint(*this, region);
+    }
 };
 
 #endif
@@ -21,8 +21,8 @@
 class WordEmbeddingsDatapoint : public Datapoint {
  private:
     double label;
-    std::vector<double> weights;
-    std::vector<int> coordinates;
+    DatapointWeights weights;
+    DatapointCoordinates coordinates;
 
     void Initialize(const std::string &input_line) {
 	// Allocate data for coordiantes / weights.
@@ -37,22 +37,35 @@ class WordEmbeddingsDatapoint : public Datapoint {
 
  public:
 
-    WordEmbeddingsDatapoint(const std::string &input_line, int order) : Datapoint(input_line, order) {
+    WordEmbeddingsDatapoint(const std::string &input_line, DatapointIndex order) : Datapoint(input_line, order) {
 	Initialize(input_line);
     }
     ~WordEmbeddingsDatapoint() {}
 
-    std::vector<double> & GetWeights() override {
+    // Copy of other, with its coordinates and weights allocated from region.
+    WordEmbeddingsDatapoint(const WordEmbeddingsDatapoint &other, DatapointRegion *region) : Datapoint(other), label(other.label),
+	weights(other.weights, DatapointAllocator<double>(region)),
+	coordinates(other.coordinates, DatapointAllocator<int>(region)) {}
+
+    DatapointWeights & GetWeights() override {
 	return weights;
     }
 
-    std::vector<int> & GetCoordinates() override {
+    DatapointCoordinates & GetCoordinates() override {
 	return coordinates;
     }
 
     int GetNumCoordinateTouches() override {
 	return 2;
     }
+
+    size_t ObjectSize() override {
+	return sizeof(WordEmbeddingsDatapoint);
+    }
+
+    Datapoint * CopyTo(void *memory, DatapointRegion *region) override {
+	return new (memory) WordEmbeddingsDatapoint(*this, region);
+    }
 };
 
 #endif
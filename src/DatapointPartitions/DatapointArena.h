@@ -0,0 +1,93 @@
+/*
+* Copyright 2016 [See AUTHORS file for list of authors]
+*
+*    Licensed under the Apache License, Version 2.0 (the "License");
+*    you may not use this file except in compliance with the License.
+*    You may obtain a copy of the License at
+*
+*        http://www.apache.org/licenses/LICENSE-2.0
+*
+*    Unless required by applicable law or agreed to in writing, software
+*    distributed under the License is distributed on an "AS IS" BASIS,
+*    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*    See the License for the specific language governing permissions and
+*    limitations under the License.
+*/
+
+#ifndef _DATAPOINT_ARENA_
+#define _DATAPOINT_ARENA_
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <iostream>
+#include <vector>
+#include "../Datapoint/Datapoint.h"
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+// Contiguous storage for copies of the datapoints of a thread.
+//
+// Relocate copies the datapoints, in the order given (i.e: the order the
+// thread processes them in), back to back into a single allocation, each
+// followed by its coordinates and weights (allocated from the arena, see
+// DatapointAllocator), so that the thread streams through all it reads of
+// them sequentially rather than chasing pointers to objects and vectors
+// scattered through the heap in file order. Call it from the thread that
+// processes them: the arena is then first touched by it, and with
+// first-touch page placement lives on its NUMA node.
+//
+// The copies are destroyed along with the arena. The originals are left
+// untouched and stay alive: they are owned by the caller of the trainer, and
+// passes over the whole dataset (loss computation, full gradients) still go
+// through them.
+class DatapointArena {
+ private:
+    char *memory;
+    DatapointRegion region;
+    std::vector<Datapoint *> copies;
+
+    static size_t Aligned(size_t size) {
+	return DatapointRegion::Aligned(size);
+    }
+
+ public:
+    DatapointArena() : memory(NULL) {}
+    DatapointArena(const DatapointArena &other) = delete;
+    DatapointArena &operator=(const DatapointArena &other) = delete;
+    ~DatapointArena() {
+	for (auto const & copy : copies) {
+	    copy->~Datapoint();
+	}
+	free(memory);
+    }
+
+    // Replace every datapoint of the list by its copy in the arena. Datapoints
+    // that can't be copied (see Datapoint::CopyTo) are left as they are.
+    void Relocate(std::vector<Datapoint *> &datapoints) {
+	size_t size = 0;
+	for (auto const & datapoint : datapoints) {
+	    if (datapoint->ObjectSize() == 0) continue;
+	    size += Aligned(datapoint->ObjectSize()) +
+		Aligned(datapoint->GetWeights().size() * sizeof(double)) +
+		Aligned(datapoint->GetCoordinates().size() * sizeof(int));
+	}
+	if (size == 0) return;
+	void *allocation = NULL;
+	if (posix_memalign(&allocation, CACHE_LINE_SIZE, size) != 0) {
+	    std::cerr << "DatapointArena: Could not allocate arena." << std::endl;
+	    exit(0);
+	}
+	memory = (char *)allocation;
+	region.Reset(memory, size);
+	for (auto & datapoint : datapoints) {
+	    size_t object_size = datapoint->ObjectSize();
+	    if (object_size == 0) continue;
+	    datapoint = datapoint->CopyTo(region.Allocate(object_size), &region);
+	    copies.push_back(datapoint);
+	}
+    }
+};
+
+#endif
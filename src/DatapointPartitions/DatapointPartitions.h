@@ -17,7 +17,9 @@
 #ifndef _DATAPOINT_PARTITIONS_
 #define _DATAPOINT_PARTITIONS_
 
-typedef std::tuple<int, int> ThreadLoadPair;
+#include "DatapointArena.h"
+
+typedef std::tuple<int, DatapointIndex> ThreadLoadPair;
 struct ThreadLoadComp {
     bool operator()(const ThreadLoadPair &s1, const ThreadLoadPair &s2) {
 	return std::get<1>(s1) > std::get<1>(s2);
@@ -25,13 +27,33 @@ struct ThreadLoadComp {
 };
 
 
+// Assignment of datapoints to threads, in batches.
+//
+// Datapoints are referred to by id, their position in the list partitioned
+// (i.e: GetOrder()-1). Each thread has a single array of the ids of its
+// datapoints, in processing order, and batch b of thread t is the range
+// starting at batch_starts[b * n_threads + t] of that array.
 class DatapointPartitions {
  private:
     int n_threads;
-    std::vector<std::vector<Datapoint *>> datapoints_per_thread;
-    std::vector<std::vector<int>> batch_indices;
+    DatapointIndex n_datapoints;
+    std::vector<std::vector<DatapointIndex>> ids_per_thread;
+    std::vector<DatapointIndex> batch_starts;
     std::vector<ThreadLoadPair> thread_load_heap;
 
+    // Datapoints by id: the list partitioned, or their copies once relocated
+    // (shared by copies of the partitions, as are the arenas holding them).
+    Datapoint * const *datapoints;
+    std::shared_ptr<std::vector<Datapoint *>> relocated_datapoints;
+    std::vector<std::shared_ptr<DatapointArena>> arenas;
+
+    // Groups of datapoints added together by AddDatapointsToLeastLoadedThread
+    // (e.g: cyclades components). Start of each group within its thread's
+    // datapoints, and the index of the first group of batch b of thread t at
+    // batch_component_starts[b * n_threads + t].
+    std::vector<std::vector<DatapointIndex>> component_starts;
+    std::vector<int> batch_component_starts;
+
     void ClearThreadLoadHeap() {
 	for (int i = 0; i < n_threads;i ++) {
 	    std::get<0>(thread_load_heap[i]) = i;
@@ -39,14 +61,43 @@ class DatapointPartitions {
 	}
     }
 
+    inline DatapointIndex BatchEnd(int thread, int batch) const {
+	if (batch == NumBatches()-1) {
+	    return ids_per_thread[thread].size();
+	}
+	return batch_starts[(batch+1) * n_threads + thread];
+    }
+
+    inline int BatchComponentEnd(int thread, int batch) const {
+	if (batch == NumBatches()-1) {
+	    return component_starts[thread].size();
+	}
+	return batch_component_starts[(batch+1) * n_threads + thread];
+    }
+
+    void AddComponentToThread(Datapoint * const *datapoints, DatapointIndex n, int thread) {
+	component_starts[thread].push_back(ids_per_thread[thread].size());
+	for (DatapointIndex i = 0; i < n; i++) {
+	    AddDatapointToThread(datapoints[i], thread);
+	}
+    }
+
  public:
-    DatapointPartitions(int n_threads) {
+    DatapointPartitions(const std::vector<Datapoint *> &datapoints, int n_threads) {
 	this->n_threads = n_threads;
-	datapoints_per_thread.resize(n_threads);
-	batch_indices.resize(n_threads);
-	for (int i = 0; i < n_threads; i++) {
-	    batch_indices[i].push_back(0);
+	this->n_datapoints = datapoints.size();
+	this->datapoints = datapoints.data();
+	for (DatapointIndex i = 0; i < n_datapoints; i++) {
+	    if (datapoints[i]->GetOrder() != i+1) {
+		std::cerr << "DatapointPartitions: Datapoint orders must be their positions in the list (starting from 1)." << std::endl;
+		exit(0);
+	    }
 	}
+	ids_per_thread.resize(n_threads);
+	component_starts.resize(n_threads);
+	arenas.resize(n_threads);
+	batch_starts.resize(n_threads, 0);
+	batch_component_starts.resize(n_threads, 0);
 	thread_load_heap.resize(n_threads);
 	ClearThreadLoadHeap();
     }
@@ -54,20 +105,28 @@ class DatapointPartitions {
 
     void StartNewBatch() {
 	for (int i = 0; i < n_threads; i++) {
-	    batch_indices[i].push_back(datapoints_per_thread[i].size());
+	    batch_starts.push_back(ids_per_thread[i].size());
+	}
+	for (int i = 0; i < n_threads; i++) {
+	    batch_component_starts.push_back(component_starts[i].size());
 	}
 	ClearThreadLoadHeap();
     }
 
     void AddDatapointToThread(Datapoint * datapoint, int thread) {
-	datapoints_per_thread[thread].push_back(datapoint);
+	ids_per_thread[thread].push_back(datapoint->GetOrder()-1);
     }
 
     void AddDatapointsToLeastLoadedThread(const std::vector<Datapoint *> &datapoints) {
+	AddDatapointsToLeastLoadedThread(datapoints.data(), datapoints.size());
+    }
+
+    // The n datapoints at datapoints (e.g: a component).
+    void AddDatapointsToLeastLoadedThread(Datapoint * const *datapoints, DatapointIndex n) {
 	// Get least loaded thread.
 	ThreadLoadPair lightest_thread_load_pair = thread_load_heap.front();
 	int lightest_thread = std::get<0>(lightest_thread_load_pair);
-	int weight = std::get<1>(lightest_thread_load_pair);
+	DatapointIndex weight = std::get<1>(lightest_thread_load_pair);
 
 	// Remove lightest thread-load pair.
 	std::pop_heap(thread_load_heap.begin(),
@@ -76,33 +135,117 @@ class DatapointPartitions {
 	thread_load_heap.pop_back();
 
 	// Add.
-	for (auto const & datapoint : datapoints) {
-	    AddDatapointToThread(datapoint, lightest_thread);
-	}
+	AddComponentToThread(datapoints, n, lightest_thread);
 
 	// Add the updated thread-load pair back to the heap
-	std::get<1>(lightest_thread_load_pair) = weight+datapoints.size();
+	std::get<1>(lightest_thread_load_pair) = weight+n;
 	thread_load_heap.push_back(lightest_thread_load_pair);
 	std::push_heap(thread_load_heap.begin(),
 		       thread_load_heap.end(),
 		       ThreadLoadComp());
     }
 
-    int NumBatches() {
-	return batch_indices[0].size();
+    // Like AddDatapointsToLeastLoadedThread, but prefer the least loaded of
+    // threads [first_thread, end_thread) (e.g: those of a NUMA node), unless
+    // it has more than slack datapoints more than the least loaded thread.
+    void AddDatapointsToLeastLoadedThreadIn(Datapoint * const *datapoints, DatapointIndex n,
+					    int first_thread, int end_thread, int slack) {
+	int preferred = -1;
+	for (int i = 0; i < thread_load_heap.size(); i++) {
+	    int thread = std::get<0>(thread_load_heap[i]);
+	    if (thread < first_thread || thread >= end_thread) continue;
+	    if (preferred < 0 || std::get<1>(thread_load_heap[i]) < std::get<1>(thread_load_heap[preferred])) {
+		preferred = i;
+	    }
+	}
+	if (preferred < 0 || std::get<1>(thread_load_heap[preferred]) > std::get<1>(thread_load_heap.front()) + slack) {
+	    AddDatapointsToLeastLoadedThread(datapoints, n);
+	    return;
+	}
+
+	AddComponentToThread(datapoints, n, std::get<0>(thread_load_heap[preferred]));
+	std::get<1>(thread_load_heap[preferred]) += n;
+	std::make_heap(thread_load_heap.begin(),
+		       thread_load_heap.end(),
+		       ThreadLoadComp());
+    }
+
+    // Copy each thread's datapoints, in processing order, into an arena
+    // allocated by the thread (see DatapointArena).
+    void Relocate() {
+	relocated_datapoints = std::make_shared<std::vector<Datapoint *>>(datapoints, datapoints + n_datapoints);
+	std::vector<Datapoint *> &relocated = *relocated_datapoints;
+#pragma omp parallel num_threads(n_threads)
+	{
+	    int thread = omp_get_thread_num();
+	    const std::vector<DatapointIndex> &ids = ids_per_thread[thread];
+	    std::vector<Datapoint *> thread_datapoints(ids.size());
+	    for (DatapointIndex i = 0; i < ids.size(); i++) {
+		thread_datapoints[i] = datapoints[ids[i]];
+	    }
+	    arenas[thread] = std::make_shared<DatapointArena>();
+	    arenas[thread]->Relocate(thread_datapoints);
+	    for (DatapointIndex i = 0; i < ids.size(); i++) {
+		relocated[ids[i]] = thread_datapoints[i];
+	    }
+	}
+	datapoints = relocated.data();
     }
 
-    int NumDatapointsInBatch(int thread, int batch) {
-	// Last batch.
-	if (batch == NumBatches()-1) {
-	    return datapoints_per_thread[thread].size() - batch_indices[thread][batch];
+    // Reallocate each thread's ids, and the coordinates and weights of its
+    // datapoints, from the thread, so that with first-touch page placement
+    // they live on its NUMA node.
+    void Localize() {
+#pragma omp parallel num_threads(n_threads)
+	{
+	    int thread = omp_get_thread_num();
+	    std::vector<DatapointIndex>(ids_per_thread[thread]).swap(ids_per_thread[thread]);
+	    for (auto const & id : ids_per_thread[thread]) {
+		DatapointCoordinates &coordinates = datapoints[id]->GetCoordinates();
+		DatapointWeights &weights = datapoints[id]->GetWeights();
+		DatapointCoordinates(coordinates).swap(coordinates);
+		DatapointWeights(weights).swap(weights);
+	    }
 	}
-	return batch_indices[thread][batch+1] - batch_indices[thread][batch];
     }
 
-    Datapoint * GetDatapoint(int thread, int batch, int index) {
-	int real_index = batch_indices[thread][batch] + index;
-	return datapoints_per_thread[thread][real_index];
+    inline int NumBatches() const {
+	return batch_starts.size() / n_threads;
+    }
+
+    inline DatapointIndex NumDatapointsInBatch(int thread, int batch) const {
+	return BatchEnd(thread, batch) - batch_starts[batch * n_threads + thread];
+    }
+
+    inline DatapointIndex NumDatapointsOfThread(int thread) const {
+	return ids_per_thread[thread].size();
+    }
+
+    // Position of the first datapoint of a thread's batch among the thread's
+    // datapoints (e.g: to lay out per datapoint data of a thread alike).
+    inline DatapointIndex BatchStart(int thread, int batch) const {
+	return batch_starts[batch * n_threads + thread];
+    }
+
+    inline Datapoint * GetDatapoint(int thread, int batch, DatapointIndex index) const {
+	return datapoints[ids_per_thread[thread][batch_starts[batch * n_threads + thread] + index]];
+    }
+
+    // Components of a thread's batch (groups of datapoints added by
+    // AddDatapointsToLeastLoadedThread), as ranges of indices into the batch.
+    inline int NumComponentsInBatch(int thread, int batch) const {
+	return BatchComponentEnd(thread, batch) - batch_component_starts[batch * n_threads + thread];
+    }
+
+    inline DatapointIndex ComponentStart(int thread, int batch, int component) const {
+	return component_starts[thread][batch_component_starts[batch * n_threads + thread] + component] - BatchStart(thread, batch);
+    }
+
+    inline DatapointIndex ComponentSize(int thread, int batch, int component) const {
+	if (component == NumComponentsInBatch(thread, batch)-1) {
+	    return NumDatapointsInBatch(thread, batch) - ComponentStart(thread, batch, component);
+	}
+	return ComponentStart(thread, batch, component+1) - ComponentStart(thread, batch, component);
     }
 };
 
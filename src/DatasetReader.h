@@ -48,7 +48,7 @@ class DatasetReader {
 
 	// 2nd line+ : datapoint initialization.
 	std::string datapoint_line;
-	int datapoint_count = 0;
+	DatapointIndex datapoint_count = 0;
 	while (std::getline(data_file_input, datapoint_line)) {
 	    datapoints.push_back(new DATAPOINT_CLASS(datapoint_line, datapoint_count++));
 	}
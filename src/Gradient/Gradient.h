@@ -30,11 +30,16 @@ class Gradient {
     std::vector<double> coeffs;
     Datapoint *datapoint;
 
-    Gradient() {}
+    // For models whose gradient is a scalar times the datapoint's
+    // weights, that scalar (see Model::HasScalarGradient).
+    double scalar_coeff;
+
+    Gradient() : datapoint(NULL), scalar_coeff(0) {}
     virtual ~Gradient() {}
 
     virtual void Clear() {
 	datapoint = NULL;
+	scalar_coeff = 0;
     }
 };
 
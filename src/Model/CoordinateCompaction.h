@@ -0,0 +1,87 @@
+/*
+* Copyright 2016 [See AUTHORS file for list of authors]
+*
+*    Licensed under the Apache License, Version 2.0 (the "License");
+*    you may not use this file except in compliance with the License.
+*    You may obtain a copy of the License at
+*
+*        http://www.apache.org/licenses/LICENSE-2.0
+*
+*    Unless required by applicable law or agreed to in writing, software
+*    distributed under the License is distributed on an "AS IS" BASIS,
+*    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*    See the License for the specific language governing permissions and
+*    limitations under the License.
+*/
+
+#ifndef _COORDINATE_COMPACTION_
+#define _COORDINATE_COMPACTION_
+
+#include <stdio.h>
+#include <iostream>
+#include <vector>
+#include "Model.h"
+
+DEFINE_bool(compact_coordinates, false, "Drop the coordinates no datapoint touches, relabeling the others to a dense range (in the same order), so that the model and everything sized by the number of coordinates shrink. Only for models that support it.");
+DEFINE_bool(print_compaction, false, "Should print the number of coordinates before and after compact_coordinates.");
+
+// Compaction of a sparsely used coordinate space (e.g: hashed features, ids
+// with gaps) to the coordinates datapoints actually touch.
+//
+// Apply relabels the model and the datapoints after Model::SetUp, and Undo
+// expands the trained model back to the original coordinates (the dropped
+// ones zeroed) and restores the datapoints'.
+class CoordinateCompaction {
+ private:
+    // Original label of each coordinate, empty if not compacted.
+    std::vector<int> original_coordinates;
+    // Number of coordinates before compaction.
+    int n_original_coordinates;
+
+ public:
+    CoordinateCompaction() : n_original_coordinates(0) {}
+    ~CoordinateCompaction() {}
+
+    void Apply(Model *model, const std::vector<Datapoint *> &datapoints) {
+	if (!FLAGS_compact_coordinates) return;
+	int n_coordinates = model->NumParameters();
+	std::vector<int> labels(n_coordinates, -1);
+	for (auto const & datapoint : datapoints) {
+	    for (auto const & coordinate : datapoint->GetCoordinates()) {
+		labels[coordinate] = 0;
+	    }
+	}
+	std::vector<int> used;
+	for (int c = 0; c < n_coordinates; c++) {
+	    if (labels[c] < 0) continue;
+	    labels[c] = used.size();
+	    used.push_back(c);
+	}
+	if (used.size() == n_coordinates) return;
+	if (!model->CompactCoordinates(labels, used.size())) {
+	    std::cerr << "CoordinateCompaction: The model does not support compaction, leaving coordinates as they are." << std::endl;
+	    return;
+	}
+#pragma omp parallel for num_threads(FLAGS_n_threads)
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
+	    datapoints[i]->RelabelCoordinates(labels);
+	}
+	original_coordinates.swap(used);
+	n_original_coordinates = n_coordinates;
+	if (FLAGS_print_compaction) {
+	    printf("Compacted coordinates: %d to %d\n", n_coordinates, (int)original_coordinates.size());
+	}
+    }
+
+    void Undo(Model *model, const std::vector<Datapoint *> &datapoints) {
+	if (original_coordinates.empty()) return;
+	model->ExpandCoordinates(original_coordinates, n_original_coordinates);
+#pragma omp parallel for num_threads(FLAGS_n_threads)
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
+	    datapoints[i]->RelabelCoordinates(original_coordinates);
+	}
+	original_coordinates.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,181 @@
+/*
+* Copyright 2016 [See AUTHORS file for list of authors]
+*
+*    Licensed under the Apache License, Version 2.0 (the "License");
+*    you may not use this file except in compliance with the License.
+*    You may obtain a copy of the License at
+*
+*        http://www.apache.org/licenses/LICENSE-2.0
+*
+*    Unless required by applicable law or agreed to in writing, software
+*    distributed under the License is distributed on an "AS IS" BASIS,
+*    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*    See the License for the specific language governing permissions and
+*    limitations under the License.
+*/
+
+#ifndef _COORDINATE_ORDERING_
+#define _COORDINATE_ORDERING_
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Model.h"
+
+DEFINE_string(coordinate_order, "none", "Relabel the coordinates before training so that rows of the model used together are close together: none, degree (most used first), bfs (breadth first over the datapoint - coordinate graph), cm (Cuthill-McKee) or rcm (reverse Cuthill-McKee). The model is relabeled back after training.");
+
+// Relabeling of the coordinates (and so of the rows of the model) to improve
+// the locality of the model accesses of updates.
+//
+// Orders are computed over the bipartite graph of datapoints and the
+// coordinates they touch: coordinates are adjacent through a shared
+// datapoint. Apply relabels the datapoints and the model after Model::SetUp
+// (so any data the model derives from the datapoints there, e.g: offsets of
+// MC movie coordinates, is in place first, see Model::PermuteCoordinates),
+// Undo restores the original labels.
+class CoordinateOrdering {
+ private:
+    // New label of each coordinate, empty if unchanged.
+    std::vector<int> new_of_old;
+
+    // Datapoints touching each coordinate, coordinate c's being
+    // datapoint_lists[starts[c], starts[c+1]).
+    std::vector<DatapointIndex> starts, datapoint_lists;
+
+    void BuildCoordinateDatapoints(const std::vector<Datapoint *> &datapoints, int n_coordinates) {
+	starts.assign(n_coordinates+1, 0);
+	for (auto const & datapoint : datapoints) {
+	    for (auto const & coordinate : datapoint->GetCoordinates()) {
+		starts[coordinate+1]++;
+	    }
+	}
+	for (int c = 0; c < n_coordinates; c++) {
+	    starts[c+1] += starts[c];
+	}
+	datapoint_lists.resize(starts[n_coordinates]);
+	std::vector<DatapointIndex> cursors(starts.begin(), starts.end()-1);
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
+	    for (auto const & coordinate : datapoints[i]->GetCoordinates()) {
+		datapoint_lists[cursors[coordinate]++] = i;
+	    }
+	}
+    }
+
+    DatapointIndex Degree(int coordinate) {
+	return starts[coordinate+1] - starts[coordinate];
+    }
+
+    // Coordinates by decreasing number of datapoints touching them.
+    std::vector<int> DegreeOrder(int n_coordinates) {
+	std::vector<int> order(n_coordinates);
+	for (int c = 0; c < n_coordinates; c++) {
+	    order[c] = c;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return Degree(a) > Degree(b); });
+	return order;
+    }
+
+    // Coordinates in breadth first order, each connected part from its
+    // coordinate of smallest degree. With cuthill_mckee the coordinates
+    // reached from a coordinate are visited by increasing degree. Untouched
+    // coordinates go last.
+    std::vector<int> BFSOrder(const std::vector<Datapoint *> &datapoints, int n_coordinates, bool cuthill_mckee) {
+	std::vector<int> seeds(n_coordinates);
+	for (int c = 0; c < n_coordinates; c++) {
+	    seeds[c] = c;
+	}
+	std::stable_sort(seeds.begin(), seeds.end(), [&](int a, int b) { return Degree(a) < Degree(b); });
+
+	std::vector<char> visited(n_coordinates, 0), expanded(datapoints.size(), 0);
+	std::vector<int> order, reached;
+	order.reserve(n_coordinates);
+	for (auto const & seed : seeds) {
+	    if (visited[seed] || Degree(seed) == 0) continue;
+	    visited[seed] = 1;
+	    int head = (int)order.size();
+	    order.push_back(seed);
+	    while (head < order.size()) {
+		int coordinate = order[head++];
+		reached.clear();
+		for (DatapointIndex i = starts[coordinate]; i < starts[coordinate+1]; i++) {
+		    DatapointIndex datapoint = datapoint_lists[i];
+		    if (expanded[datapoint]) continue;
+		    expanded[datapoint] = 1;
+		    for (auto const & neighbor : datapoints[datapoint]->GetCoordinates()) {
+			if (visited[neighbor]) continue;
+			visited[neighbor] = 1;
+			reached.push_back(neighbor);
+		    }
+		}
+		if (cuthill_mckee) {
+		    std::stable_sort(reached.begin(), reached.end(), [&](int a, int b) { return Degree(a) < Degree(b); });
+		}
+		order.insert(order.end(), reached.begin(), reached.end());
+	    }
+	}
+	for (int c = 0; c < n_coordinates; c++) {
+	    if (!visited[c]) order.push_back(c);
+	}
+	return order;
+    }
+
+    static void Relabel(Model *model, const std::vector<Datapoint *> &datapoints, const std::vector<int> &labels) {
+	model->PermuteCoordinates(labels, FLAGS_n_threads);
+#pragma omp parallel for num_threads(FLAGS_n_threads)
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
+	    datapoints[i]->RelabelCoordinates(labels);
+	}
+    }
+
+ public:
+    CoordinateOrdering() {}
+    ~CoordinateOrdering() {}
+
+    void Apply(Model *model, const std::vector<Datapoint *> &datapoints) {
+	if (FLAGS_coordinate_order == "none") return;
+	int n_coordinates = model->NumParameters();
+	BuildCoordinateDatapoints(datapoints, n_coordinates);
+	std::vector<int> order;
+	if (FLAGS_coordinate_order == "degree") {
+	    order = DegreeOrder(n_coordinates);
+	}
+	else if (FLAGS_coordinate_order == "bfs") {
+	    order = BFSOrder(datapoints, n_coordinates, false);
+	}
+	else if (FLAGS_coordinate_order == "cm" || FLAGS_coordinate_order == "rcm") {
+	    order = BFSOrder(datapoints, n_coordinates, true);
+	    if (FLAGS_coordinate_order == "rcm") {
+		// Reverse the touched coordinates, leaving the untouched ones last.
+		int n_touched = 0;
+		while (n_touched < n_coordinates && Degree(order[n_touched]) > 0) n_touched++;
+		std::reverse(order.begin(), order.begin() + n_touched);
+	    }
+	}
+	else {
+	    std::cerr << "CoordinateOrdering: Unknown coordinate order " << FLAGS_coordinate_order << "." << std::endl;
+	    exit(0);
+	}
+	std::vector<DatapointIndex>().swap(starts);
+	std::vector<DatapointIndex>().swap(datapoint_lists);
+
+	new_of_old.resize(n_coordinates);
+	for (int i = 0; i < n_coordinates; i++) {
+	    new_of_old[order[i]] = i;
+	}
+	Relabel(model, datapoints, new_of_old);
+    }
+
+    // Restore the original coordinate labels (e.g: before using the trained model).
+    void Undo(Model *model, const std::vector<Datapoint *> &datapoints) {
+	if (new_of_old.empty()) return;
+	std::vector<int> old_of_new(new_of_old.size());
+	for (int c = 0; c < new_of_old.size(); c++) {
+	    old_of_new[new_of_old[c]] = c;
+	}
+	Relabel(model, datapoints, old_of_new);
+	new_of_old.clear();
+    }
+};
+
+#endif
@@ -23,12 +23,12 @@
 class LSModel : public Model {
  private:
     int n_coords;
-    std::vector<double> model;
-    std::vector<double> B;
+    ModelVector model;
+    ModelVector B;
 
     void MatrixVectorMultiply(const std::vector<Datapoint *> &datapoints,
 			      std::vector<double> &input_vector,
-			      std::vector<double> &output_vector) {
+			      ModelVector &output_vector) {
 	// Write to temporary vector to allow for input_vector
 	// and output_vector referencing the same vector.
 	std::vector<double> temp_vector;
@@ -75,7 +75,7 @@ class LSModel : public Model {
 	MatrixVectorMultiply(datapoints, rand_vect, B);
 
 	// Add some noise to B.
-	for (int i = 0; i < datapoints.size(); i++) {
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
 	    //B[i] += rand() % FLAGS_random_range;
 	}
     }
@@ -83,7 +83,7 @@ class LSModel : public Model {
     double ComputeLoss(const std::vector<Datapoint *> &datapoints) override {
 	double loss = 0;
 
-	for (int i = 0; i < datapoints.size(); i++) {
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
 	    Datapoint *datapoint = datapoints[i];
 	    double cross_product = 0;
 	    int row = ((LSDatapoint *)datapoint)->row;
@@ -105,11 +105,27 @@ class LSModel : public Model {
 	return 1;
     }
 
-    std::vector<double> & ModelData() override {
+    ModelVector & ModelData() override {
 	return model;
     }
 
-    void PrecomputeCoefficients(Datapoint *datapoint, Gradient *g, std::vector<double> &local_model) override {
+    // The right hand side, b, indexed by LSDatapoint::row.
+    ModelVector & ExtraData() override {
+	return B;
+    }
+
+    bool CompactCoordinates(const std::vector<int> &labels, int n_coordinates) override {
+	CompactRows(model, RowStride(), labels, n_coordinates);
+	n_coords = n_coordinates;
+	return true;
+    }
+
+    void ExpandCoordinates(const std::vector<int> &original_coordinates, int n_coordinates) override {
+	ExpandRows(model, RowStride(), original_coordinates, n_coordinates);
+	n_coords = n_coordinates;
+    }
+
+    void PrecomputeCoefficients(Datapoint *datapoint, Gradient *g, ModelVector &local_model) override {
 	if (g->coeffs.size() != n_coords) g->coeffs.resize(n_coords);
 	int row = ((LSDatapoint *)datapoint)->row;
 	double cp = 0;
@@ -119,6 +135,7 @@ class LSModel : public Model {
 	    cp += weight * local_model[index];
 	}
 	double partial_grad = 2 * (cp - B[row]);
+	g->scalar_coeff = partial_grad;
 	for (int i = 0; i < datapoint->GetCoordinates().size(); i++) {
 	    int index = datapoint->GetCoordinates()[i];
 	    double weight = datapoint->GetWeights()[i];
@@ -126,15 +143,43 @@ class LSModel : public Model {
 	}
     }
 
-    void Lambda(int coordinate, double &out, std::vector<double> &local_model) override {
+    bool StaticLambda() override {
+	return true;
+    }
+
+    bool UniformLambda() override {
+	return true;
+    }
+
+    bool StaticKappa() override {
+	return true;
+    }
+
+    bool HasScalarGradient() override {
+	return true;
+    }
+
+    bool HasScalarCoefficients() override {
+	return true;
+    }
+
+    void RestoreCoefficients(Datapoint *datapoint, Gradient *g, double scalar_coeff) override {
+	if (g->coeffs.size() != n_coords) g->coeffs.resize(n_coords);
+	for (int i = 0; i < datapoint->GetCoordinates().size(); i++) {
+	    g->coeffs[datapoint->GetCoordinates()[i]] = scalar_coeff * datapoint->GetWeights()[i];
+	}
+	g->scalar_coeff = scalar_coeff;
+    }
+
+    void Lambda(int coordinate, double &out, ModelVector &local_model) override {
 	out = 0;
     }
 
-    void Kappa(int coordinate, std::vector<double> &out, std::vector<double> &local_model) override {
+    void Kappa(int coordinate, std::vector<double> &out, ModelVector &local_model) override {
 	out[0] = 0;
     }
 
-    void H_bar(int coordinate, std::vector<double> &out, Gradient *g, std::vector<double> &local_model) override {
+    void H_bar(int coordinate, std::vector<double> &out, Gradient *g, ModelVector &local_model) override {
 	out[0] = g->coeffs[coordinate];
     }
 
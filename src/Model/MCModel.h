@@ -24,15 +24,18 @@ DEFINE_int32(rlength, 100, "Length of vector in matrix completion.");
 
 class MCModel : public Model {
  private:
-    std::vector<double> model;
+    ModelVector model;
     int n_users;
     int n_movies;
+    // n_users before CompactCoordinates, for ExpandCoordinates.
+    int n_users_expanded;
     int rlength;
+    int row_stride;
 
     void InitializePrivateModel() {
 	for (int i = 0; i < n_users+n_movies; i++) {
 	    for (int j = 0; j < rlength; j++) {
-		model[i*rlength+j] = ((double)rand()/(double)RAND_MAX);
+		model[i*row_stride+j] = ((double)rand()/(double)RAND_MAX);
 	    }
 	}
     }
@@ -42,9 +45,10 @@ class MCModel : public Model {
 	std::stringstream input(input_line);
 	input >> n_users >> n_movies;
 	rlength = FLAGS_rlength;
+	row_stride = AlignedRowStride(rlength + (FLAGS_interleave_bookkeeping ? 1 : 0));
 
 	// Allocate memory.
-	model.resize((n_users+n_movies) * rlength);
+	model.resize((n_users+n_movies) * row_stride);
 
 	// Initialize private model.
 	InitializePrivateModel();
@@ -70,16 +74,16 @@ class MCModel : public Model {
     double ComputeLoss(const std::vector<Datapoint *> &datapoints) override {
 	double loss = 0;
 #pragma omp parallel for num_threads(FLAGS_n_threads) reduction(+:loss)
-	for (int i = 0; i < datapoints.size(); i++) {
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
 	    Datapoint *datapoint = datapoints[i];
-	    const std::vector<double> &labels = datapoint->GetWeights();
-	    const std::vector<int> &coordinates = datapoint->GetCoordinates();
+	    const DatapointWeights &labels = datapoint->GetWeights();
+	    const DatapointCoordinates &coordinates = datapoint->GetCoordinates();
 	    double label = labels[0];
 	    int x = coordinates[0];
 	    int y = coordinates[1];
 	    double cross_product = 0;
 	    for (int j = 0; j < rlength; j++) {
-		cross_product += model[x*rlength+j] * model[y*rlength+j];
+		cross_product += model[x*row_stride+j] * model[y*row_stride+j];
 	    }
 	    double difference = cross_product - label;
 	    loss += difference * difference;
@@ -87,7 +91,7 @@ class MCModel : public Model {
 	return loss / datapoints.size();
     }
 
-    std::vector<double> & ModelData() {
+    ModelVector & ModelData() {
 	return model;
     }
 
@@ -99,35 +103,73 @@ class MCModel : public Model {
 	return rlength;
     }
 
-    void PrecomputeCoefficients(Datapoint *datapoint, Gradient *g, std::vector<double> &local_model) override {
+    // Users stay before movies, as labels keep the order of coordinates.
+    bool CompactCoordinates(const std::vector<int> &labels, int n_coordinates) override {
+	CompactRows(model, row_stride, labels, n_coordinates);
+	int n_users_kept = 0;
+	for (int c = 0; c < n_users; c++) {
+	    if (labels[c] >= 0) n_users_kept++;
+	}
+	n_users_expanded = n_users;
+	n_users = n_users_kept;
+	n_movies = n_coordinates - n_users_kept;
+	return true;
+    }
+
+    void ExpandCoordinates(const std::vector<int> &original_coordinates, int n_coordinates) override {
+	ExpandRows(model, row_stride, original_coordinates, n_coordinates);
+	n_users = n_users_expanded;
+	n_movies = n_coordinates - n_users;
+    }
+
+    int RowStride() override {
+	return row_stride;
+    }
+
+    bool HasRowStamps() override {
+	return FLAGS_interleave_bookkeeping;
+    }
+
+    void PrecomputeCoefficients(Datapoint *datapoint, Gradient *g, ModelVector &local_model) override {
 	if (g->coeffs.size() != 1) g->coeffs.resize(1);
-	const std::vector<double> &labels = datapoint->GetWeights();
-	const std::vector<int> &coordinates = datapoint->GetCoordinates();
+	const DatapointWeights &labels = datapoint->GetWeights();
+	const DatapointCoordinates &coordinates = datapoint->GetCoordinates();
 	int user_coordinate = coordinates[0];
 	int movie_coordinate = coordinates[1];
 	double label = labels[0];
 	double coeff = 0;
 	for (int i = 0; i < rlength; i++) {
-	    coeff += local_model[user_coordinate*rlength+i] * local_model[movie_coordinate*rlength+i];
+	    coeff += local_model[user_coordinate*row_stride+i] * local_model[movie_coordinate*row_stride+i];
 	}
 	coeff -= label;
 	g->coeffs[0] = coeff;
+	g->scalar_coeff = coeff;
+    }
+
+    bool HasScalarCoefficients() override {
+	return true;
+    }
+
+    void RestoreCoefficients(Datapoint *datapoint, Gradient *g, double scalar_coeff) override {
+	if (g->coeffs.size() != 1) g->coeffs.resize(1);
+	g->coeffs[0] = scalar_coeff;
+	g->scalar_coeff = scalar_coeff;
     }
 
-    void Lambda(int coordinate, double &out, std::vector<double> &local_model) override {
+    void Lambda(int coordinate, double &out, ModelVector &local_model) override {
     }
 
-    void Kappa(int coordinate, std::vector<double> &out, std::vector<double> &local_model) override {
+    void Kappa(int coordinate, std::vector<double> &out, ModelVector &local_model) override {
     }
 
-    void H_bar(int coordinate, std::vector<double> &out, Gradient *g, std::vector<double> &local_model) override {
+    void H_bar(int coordinate, std::vector<double> &out, Gradient *g, ModelVector &local_model) override {
 	double other_coordinate = 0;
 	if (g->datapoint->GetCoordinates()[0] == coordinate)
 	    other_coordinate = g->datapoint->GetCoordinates()[1];
 	else
 	    other_coordinate = g->datapoint->GetCoordinates()[0];
 	for (int i = 0; i < rlength; i++) {
-	    out[i] = g->coeffs[0] * local_model[other_coordinate * rlength + i];
+	    out[i] = g->coeffs[0] * local_model[other_coordinate * row_stride + i];
 	}
     }
 };
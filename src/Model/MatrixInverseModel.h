@@ -27,7 +27,7 @@ class MatrixInverseModel : public Model {
 private:
     int n_coords;
     double lambda;
-    std::vector<double> model;
+    ModelVector model;
     std::vector<double> B;
 
     void Initialize(const std::string &input_line) {
@@ -111,7 +111,7 @@ public:
 
     void SetUp(const std::vector<Datapoint *> &datapoints) override {
 	// Normalize the rows formed by the datapoint.
-	for (int dp = 0; dp < datapoints.size(); dp++) {
+	for (DatapointIndex dp = 0; dp < datapoints.size(); dp++) {
 	    double sum_sqr = 0;
 	    for (const auto &w : datapoints[dp]->GetWeights()) {
 		sum_sqr += w*w;
@@ -169,7 +169,7 @@ public:
 	}
 
 #pragma omp parallel for num_threads(FLAGS_n_threads) reduction(+:loss)
-	for (int i = 0; i < datapoints.size(); i++) {
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
 	    double ai_t_x = 0;
 	    double first = sum_sqr / (double)n_coords * lambda;
 	    for (int j = 0; j < datapoints[i]->GetWeights().size(); j++) {
@@ -192,33 +192,71 @@ public:
 	return 1;
     }
 
-    std::vector<double> & ModelData() override {
+    ModelVector & ModelData() override {
 	return model;
     }
 
-    void PrecomputeCoefficients(Datapoint *datapoint, Gradient *g, std::vector<double> &local_model) override {
+    void PermuteCoordinates(const std::vector<int> &labels, int n_threads) override {
+	Model::PermuteCoordinates(labels, n_threads);
+	std::vector<double> permuted_B(B.size());
+	for (int c = 0; c < labels.size(); c++) {
+	    permuted_B[labels[c]] = B[c];
+	}
+	B.swap(permuted_B);
+    }
+
+    void PrecomputeCoefficients(Datapoint *datapoint, Gradient *g, ModelVector &local_model) override {
 	if (g->coeffs.size() != n_coords) g->coeffs.resize(n_coords);
-	const std::vector<double> &weights = datapoint->GetWeights();
-	const std::vector<int> &coordinates = datapoint->GetCoordinates();
+	const DatapointWeights &weights = datapoint->GetWeights();
+	const DatapointCoordinates &coordinates = datapoint->GetCoordinates();
 	double product = 0;
 	for (int i = 0; i < coordinates.size(); i++) {
 	    product += local_model[coordinates[i]] * weights[i];
 	}
+	g->scalar_coeff = product;
 	for (int i = 0; i < coordinates.size(); i++) {
 	    int index = coordinates[i];
 	    g->coeffs[index] = product * weights[i];
 	}
     }
 
-    void Lambda(int coordinate, double &out, std::vector<double> &local_model) override {
+    bool StaticLambda() override {
+	return true;
+    }
+
+    bool UniformLambda() override {
+	return true;
+    }
+
+    bool StaticKappa() override {
+	return true;
+    }
+
+    bool HasScalarGradient() override {
+	return true;
+    }
+
+    bool HasScalarCoefficients() override {
+	return true;
+    }
+
+    void RestoreCoefficients(Datapoint *datapoint, Gradient *g, double scalar_coeff) override {
+	if (g->coeffs.size() != n_coords) g->coeffs.resize(n_coords);
+	for (int i = 0; i < datapoint->GetCoordinates().size(); i++) {
+	    g->coeffs[datapoint->GetCoordinates()[i]] = scalar_coeff * datapoint->GetWeights()[i];
+	}
+	g->scalar_coeff = scalar_coeff;
+    }
+
+    void Lambda(int coordinate, double &out, ModelVector &local_model) override {
 	out = lambda / (double)n_coords;
     }
 
-    void Kappa(int coordinate, std::vector<double> &out, std::vector<double> &local_model) override {
+    void Kappa(int coordinate, std::vector<double> &out, ModelVector &local_model) override {
 	out[0] = B[coordinate] / (double)n_coords;
     }
 
-    void H_bar(int coordinate, std::vector<double> &out, Gradient *g, std::vector<double> &local_model) override {
+    void H_bar(int coordinate, std::vector<double> &out, Gradient *g, ModelVector &local_model) override {
 	out[0] = g->coeffs[coordinate];
     }
 };
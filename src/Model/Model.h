@@ -17,9 +17,24 @@
 #define _MODEL_
 
 #include "../DatapointPartitions/DatapointPartitions.h"
+#include "../Allocator/HugePageAllocator.h"
+
+DEFINE_bool(interleave_bookkeeping, false, "Store the last-touch stamp of each coordinate at the end of its row of the model (so in the same cache line), rather than in a separate array. Only for models with wide rows (matrix completion), where the extra double is cheap; models with a double per coordinate keep the separate array, as a stamp there would double the model.");
+
+DEFINE_bool(align_model_rows, true, "Pad the rows of models with several doubles per coordinate (matrix completion, word embeddings) to a whole number of cache lines, so that no row straddles two lines.");
 
 class Model {
  public:
+    // Stride, in values of value_size bytes, for rows of row_size values:
+    // rounded up to a whole number of cache lines (see
+    // FLAGS_align_model_rows). Also used for reduced precision copies of the
+    // model (see ReducedPrecisionModel).
+    static int AlignedRowStride(int row_size, size_t value_size = sizeof(double)) {
+	if (!FLAGS_align_model_rows) return row_size;
+	int values_per_line = CACHE_LINE_SIZE / value_size;
+	return (row_size + values_per_line - 1) / values_per_line * values_per_line;
+    }
+
     Model() {}
     Model(const std::string &input_line) {}
     virtual ~Model() {}
@@ -40,21 +55,122 @@ class Model {
     virtual int CoordinateSize() = 0;
 
     // Return data to actual model.
-    virtual std::vector<double> & ModelData() = 0;
+    virtual ModelVector & ModelData() = 0;
+
+    // Layout of ModelData(): coordinate c is stored at
+    // [c * RowStride(), c * RowStride() + CoordinateSize()).
+    // If HasRowStamps(), the last double of each row's stride,
+    // c * RowStride() + RowStride() - 1, is reserved for updaters to keep the
+    // coordinate's last-touch stamp in (see --interleave_bookkeeping), and
+    // must be left alone by the model. It directly follows the row only
+    // when the stride isn't padded, so RowStride() must leave room for it.
+    virtual int RowStride() {
+	return CoordinateSize();
+    }
+    virtual bool HasRowStamps() {
+	return false;
+    }
+
+    // Relabel coordinate c as labels[c] (see CoordinateOrdering): move the
+    // data the model keeps per coordinate accordingly. By default, the rows
+    // of ModelData(), moved by n_threads threads.
+    virtual void PermuteCoordinates(const std::vector<int> &labels, int n_threads) {
+	ModelVector &model_data = ModelData();
+	ModelVector permuted(model_data.size());
+	int row_stride = RowStride();
+#pragma omp parallel for num_threads(n_threads)
+	for (int c = 0; c < labels.size(); c++) {
+	    std::copy(model_data.begin() + (size_t)c * row_stride,
+		      model_data.begin() + (size_t)(c+1) * row_stride,
+		      permuted.begin() + (size_t)labels[c] * row_stride);
+	}
+	model_data.swap(permuted);
+    }
+
+    // Keep only the coordinates c with labels[c] >= 0, relabeled labels[c],
+    // n_coordinates of them (see CoordinateCompaction). Returns false if the
+    // model doesn't support changing its number of coordinates (the default).
+    virtual bool CompactCoordinates(const std::vector<int> &labels, int n_coordinates) {
+	return false;
+    }
+
+    // Undo CompactCoordinates: move coordinate c back to
+    // original_coordinates[c], of n_coordinates. The coordinates dropped
+    // come back zeroed.
+    virtual void ExpandCoordinates(const std::vector<int> &original_coordinates, int n_coordinates) {
+    }
 
     // Return some extra data which may be useful to be modified.
-    virtual std::vector<double> & ExtraData() {
+    virtual ModelVector & ExtraData() {
 	// Default: return ModelData.
 	return ModelData();
     }
 
+    // Whether the h term of the gradient (see below) at a datapoint is a single
+    // scalar times the datapoint's weights, i.e: h_bar_j(x) = c * w_j.
+    // If so, PrecomputeCoefficients must also store c in g->scalar_coeff.
+    // This lets updaters keep a scalar per datapoint rather than a full gradient
+    // (SAGA only does so for models whose coordinates are single doubles).
+    virtual bool HasScalarGradient() {
+	return false;
+    }
+
+    // Whether everything PrecomputeCoefficients computes at a datapoint is
+    // determined by a single scalar, which it must then also store in
+    // g->scalar_coeff. RestoreCoefficients rebuilds g from that scalar as if
+    // PrecomputeCoefficients had been called, letting updaters cache the
+    // coefficients at a model that doesn't change (e.g: SVRG's snapshot).
+    virtual bool HasScalarCoefficients() {
+	return false;
+    }
+    virtual void RestoreCoefficients(Datapoint *datapoint, Gradient *g, double scalar_coeff) {}
+
+    // Properties of Lambda and Kappa below which let updaters compute them
+    // once at set up rather than on every update:
+    // StaticLambda / StaticKappa - doesn't depend on local_model.
+    // UniformLambda - Lambda is the same for every coordinate.
+    virtual bool StaticLambda() {
+	return false;
+    }
+    virtual bool UniformLambda() {
+	return false;
+    }
+    virtual bool StaticKappa() {
+	return false;
+    }
+
     // The following are for updates of the form:
     // [∇f(x)] = λx − κ + h(x)
     // See https://arxiv.org/pdf/1605.09721v1.pdf page 20 for more details.
-    virtual void PrecomputeCoefficients(Datapoint *datapoint, Gradient *g, std::vector<double> &local_model) = 0;
-    virtual void Lambda(int coordinate, double &out, std::vector<double> &local_model) = 0;
-    virtual void Kappa(int coordinate, std::vector<double> &out, std::vector<double> &local_model) = 0;
-    virtual void H_bar(int coordinate, std::vector<double> &out, Gradient *g, std::vector<double> &local_model) = 0;
+    virtual void PrecomputeCoefficients(Datapoint *datapoint, Gradient *g, ModelVector &local_model) = 0;
+    virtual void Lambda(int coordinate, double &out, ModelVector &local_model) = 0;
+    virtual void Kappa(int coordinate, std::vector<double> &out, ModelVector &local_model) = 0;
+    virtual void H_bar(int coordinate, std::vector<double> &out, Gradient *g, ModelVector &local_model) = 0;
+
+ protected:
+    // Helper for CompactCoordinates: keep the rows (row_stride doubles each)
+    // of data of the coordinates kept.
+    static void CompactRows(ModelVector &data, int row_stride, const std::vector<int> &labels, int n_coordinates) {
+	ModelVector compacted((size_t)n_coordinates * row_stride);
+	for (int c = 0; c < labels.size(); c++) {
+	    if (labels[c] < 0) continue;
+	    std::copy(data.begin() + (size_t)c * row_stride,
+		      data.begin() + (size_t)(c+1) * row_stride,
+		      compacted.begin() + (size_t)labels[c] * row_stride);
+	}
+	data.swap(compacted);
+    }
+
+    // Helper for ExpandCoordinates: the inverse of CompactRows.
+    static void ExpandRows(ModelVector &data, int row_stride, const std::vector<int> &original_coordinates, int n_coordinates) {
+	ModelVector expanded((size_t)n_coordinates * row_stride, 0);
+	for (int c = 0; c < original_coordinates.size(); c++) {
+	    std::copy(data.begin() + (size_t)c * row_stride,
+		      data.begin() + (size_t)(c+1) * row_stride,
+		      expanded.begin() + (size_t)original_coordinates[c] * row_stride);
+	}
+	data.swap(expanded);
+    }
 };
 
 #endif
@@ -25,16 +25,17 @@ DEFINE_int32(vec_length, 30, "Length of word embeddings vector in w2v.");
 
 class WordEmbeddingsModel : public Model {
  private:
-    std::vector<double> model;
-    std::vector<double> C;
+    ModelVector model;
+    ModelVector C;
     std::vector<double > c_sum_mult1, c_sum_mult2;
     int n_words;
     int w2v_length;
+    int row_stride;
 
     void InitializePrivateModel() {
 	for (int i = 0; i < n_words; i++) {
 	    for (int j = 0; j < w2v_length; j++) {
-		model[i*w2v_length+j] = ((double)rand()/(double)RAND_MAX);
+		model[i*row_stride+j] = ((double)rand()/(double)RAND_MAX);
 	    }
 	}
     }
@@ -44,9 +45,10 @@ class WordEmbeddingsModel : public Model {
 	std::stringstream input(input_line);
 	input >> n_words;
 	w2v_length = FLAGS_vec_length;
+	row_stride = AlignedRowStride(w2v_length);
 
 	// Allocate memory.
-	model.resize(n_words * w2v_length);
+	model.resize(n_words * row_stride);
 
 	// Initialize C = 0.
 	C.resize(1);
@@ -67,17 +69,17 @@ class WordEmbeddingsModel : public Model {
     double ComputeLoss(const std::vector<Datapoint *> &datapoints) override {
 	double loss = 0;
 #pragma omp parallel for num_threads(FLAGS_n_threads) reduction(+:loss)
-	for (int i = 0; i < datapoints.size(); i++) {
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
 	    Datapoint *datapoint = datapoints[i];
-	    const std::vector<double> &labels = datapoint->GetWeights();
-	    const std::vector<int> &coordinates = datapoint->GetCoordinates();
+	    const DatapointWeights &labels = datapoint->GetWeights();
+	    const DatapointCoordinates &coordinates = datapoint->GetCoordinates();
 	    double weight = labels[0];
 	    int x = coordinates[0];
 	    int y = coordinates[1];
 	    double cross_product = 0;
 	    for (int j = 0; j < w2v_length; j++) {
-		cross_product += (model[x*w2v_length+j]+model[y*w2v_length+j]) *
-		    (model[y*w2v_length+j]+model[y*w2v_length+j]);
+		cross_product += (model[x*row_stride+j]+model[y*row_stride+j]) *
+		    (model[y*row_stride+j]+model[y*row_stride+j]);
 	    }
 	    loss += weight * (log(weight) - cross_product - C[0]) * (log(weight) - cross_product - C[0]);
 	}
@@ -92,40 +94,55 @@ class WordEmbeddingsModel : public Model {
 	return n_words;
     }
 
-    std::vector<double> & ModelData() override {
+    ModelVector & ModelData() override {
 	return model;
     }
 
-    virtual std::vector<double> & ExtraData() override {
+    int RowStride() override {
+	return row_stride;
+    }
+
+    bool CompactCoordinates(const std::vector<int> &labels, int n_coordinates) override {
+	CompactRows(model, row_stride, labels, n_coordinates);
+	n_words = n_coordinates;
+	return true;
+    }
+
+    void ExpandCoordinates(const std::vector<int> &original_coordinates, int n_coordinates) override {
+	ExpandRows(model, row_stride, original_coordinates, n_coordinates);
+	n_words = n_coordinates;
+    }
+
+    virtual ModelVector & ExtraData() override {
 	return C;
     }
 
-    void PrecomputeCoefficients(Datapoint *datapoint, Gradient *g, std::vector<double> &local_model) override {
+    void PrecomputeCoefficients(Datapoint *datapoint, Gradient *g, ModelVector &local_model) override {
 	if (g->coeffs.size() != 1) g->coeffs.resize(1);
-	const std::vector<double> &labels = datapoint->GetWeights();
-	const std::vector<int> &coordinates = datapoint->GetCoordinates();
+	const DatapointWeights &labels = datapoint->GetWeights();
+	const DatapointCoordinates &coordinates = datapoint->GetCoordinates();
 	int coord1 = coordinates[0];
 	int coord2 = coordinates[1];
 	double weight = labels[0];
 	double norm = 0;
 	for (int i = 0; i < w2v_length; i++) {
-	    norm += (local_model[coord1*w2v_length+i] + local_model[coord2*w2v_length+i]) *
-		(local_model[coord1*w2v_length+i] + local_model[coord2*w2v_length+i]);
+	    norm += (local_model[coord1*row_stride+i] + local_model[coord2*row_stride+i]) *
+		(local_model[coord1*row_stride+i] + local_model[coord2*row_stride+i]);
 	}
 	g->coeffs[0] = 2 * weight * (log(weight) - norm - C[0]);
     }
 
-    virtual void Lambda(int coordinate, double &out, std::vector<double> &local_model) override {
+    virtual void Lambda(int coordinate, double &out, ModelVector &local_model) override {
     }
 
-    virtual void Kappa(int coordinate, std::vector<double> &out, std::vector<double> &local_model) override {
+    virtual void Kappa(int coordinate, std::vector<double> &out, ModelVector &local_model) override {
     }
 
-    virtual void H_bar(int coordinate, std::vector<double> &out, Gradient *g, std::vector<double> &local_model) override {
+    virtual void H_bar(int coordinate, std::vector<double> &out, Gradient *g, ModelVector &local_model) override {
 	int c1 = g->datapoint->GetCoordinates()[0];
 	int c2 = g->datapoint->GetCoordinates()[1];
 	for (int i = 0; i < w2v_length; i++) {
-	    out[i] = -(2 * g->coeffs[0] * (local_model[c1*w2v_length+i] + local_model[c2*w2v_length+i]));
+	    out[i] = -(2 * g->coeffs[0] * (local_model[c1*row_stride+i] + local_model[c2*row_stride+i]));
 	}
     }
 };
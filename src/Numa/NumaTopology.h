@@ -0,0 +1,215 @@
+/*
+* Copyright 2016 [See AUTHORS file for list of authors]
+*
+*    Licensed under the Apache License, Version 2.0 (the "License");
+*    you may not use this file except in compliance with the License.
+*    You may obtain a copy of the License at
+*
+*        http://www.apache.org/licenses/LICENSE-2.0
+*
+*    Unless required by applicable law or agreed to in writing, software
+*    distributed under the License is distributed on an "AS IS" BASIS,
+*    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*    See the License for the specific language governing permissions and
+*    limitations under the License.
+*/
+
+#ifndef _NUMA_TOPOLOGY_
+#define _NUMA_TOPOLOGY_
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#endif
+
+DEFINE_bool(numa_placement, false, "Place threads, datapoints, cyclades components and the model by NUMA node, as found in /sys/devices/system/node.");
+DEFINE_string(numa_model_placement, "interleave", "With numa_placement, how to place the model's pages on the nodes: interleave (round robin) or split (each node holds the rows of a contiguous range of coordinates, and cyclades components are steered to the threads of the node holding most of their rows).");
+DEFINE_double(numa_component_imbalance, .1, "With numa_placement and split model placement, how much more loaded than the least loaded thread (as a fraction of a thread's share of a batch) a thread of a component's node can be to still be given the component.");
+
+// NUMA nodes and their cpus, and the placement of threads, datapoints and the
+// model on them.
+//
+// Threads are spread over the nodes in contiguous blocks (thread t is on node
+// t * n_nodes / n_threads), each pinned to a cpu of its node, so that
+// partitions can tell the node of a thread from its number. Without NUMA
+// information (e.g: not linux) the machine is a single node.
+class NumaTopology {
+ private:
+    // Ids of the nodes (as known by the kernel), and the cpus of each.
+    std::vector<int> node_ids;
+    std::vector<std::vector<int> > node_cpus;
+
+    // Parse a cpu list such as "0-3,8-11".
+    static std::vector<int> ParseCpuList(const std::string &list) {
+	std::vector<int> cpus;
+	std::stringstream ranges(list);
+	std::string range;
+	while (std::getline(ranges, range, ',')) {
+	    int first, last;
+	    char dash;
+	    std::stringstream bounds(range);
+	    if (!(bounds >> first)) continue;
+	    if (!(bounds >> dash >> last) || dash != '-') last = first;
+	    for (int cpu = first; cpu <= last; cpu++) {
+		cpus.push_back(cpu);
+	    }
+	}
+	return cpus;
+    }
+
+    void Discover(const std::string &root) {
+	DIR *directory = opendir(root.c_str());
+	if (directory != NULL) {
+	    std::vector<int> ids;
+	    struct dirent *entry;
+	    while ((entry = readdir(directory)) != NULL) {
+		int id;
+		char rest;
+		if (sscanf(entry->d_name, "node%d%c", &id, &rest) == 1) {
+		    ids.push_back(id);
+		}
+	    }
+	    closedir(directory);
+	    std::sort(ids.begin(), ids.end());
+	    for (int i = 0; i < ids.size(); i++) {
+		std::ifstream cpulist(root + "/node" + std::to_string(ids[i]) + "/cpulist");
+		std::string list;
+		std::getline(cpulist, list);
+		std::vector<int> cpus = ParseCpuList(list);
+		// Memory only nodes have no threads.
+		if (cpus.empty()) continue;
+		node_ids.push_back(ids[i]);
+		node_cpus.push_back(cpus);
+	    }
+	}
+	if (node_ids.empty()) {
+	    node_ids.assign(1, 0);
+	    node_cpus.assign(1, std::vector<int>());
+	    for (int cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++) {
+		node_cpus[0].push_back(cpu);
+	    }
+	}
+    }
+
+    // Set the memory policy of the pages in [start, end) (rounded inwards to
+    // whole pages), moving those already touched.
+    bool Bind(char *start, char *end, int mode, const std::vector<int> &nodes) {
+#if defined(__linux__) && defined(SYS_mbind)
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	start = (char *)(((size_t)start + page_size - 1) / page_size * page_size);
+	end = (char *)((size_t)end / page_size * page_size);
+	if (end <= start) return true;
+	int max_id = *std::max_element(node_ids.begin(), node_ids.end());
+	int bits_per_word = 8 * sizeof(unsigned long);
+	std::vector<unsigned long> mask(max_id / bits_per_word + 1, 0);
+	for (const auto &node : nodes) {
+	    mask[node_ids[node] / bits_per_word] |= 1UL << (node_ids[node] % bits_per_word);
+	}
+	return syscall(SYS_mbind, start, end - start, mode, mask.data(),
+		       mask.size() * bits_per_word + 1, MPOL_MF_MOVE) == 0;
+#else
+	return false;
+#endif
+    }
+
+ public:
+    NumaTopology(const std::string &root = "/sys/devices/system/node") {
+	Discover(root);
+    }
+
+    static NumaTopology &Get() {
+	static NumaTopology topology;
+	return topology;
+    }
+
+    int NumNodes() {
+	return node_ids.size();
+    }
+
+    const std::vector<int> &CpusOfNode(int node) {
+	return node_cpus[node];
+    }
+
+    int NodeOfThread(int thread, int n_threads) {
+	return (long long)thread * NumNodes() / n_threads;
+    }
+
+    // Threads of a node are [FirstThreadOfNode(node), FirstThreadOfNode(node+1)).
+    int FirstThreadOfNode(int node, int n_threads) {
+	return ((long long)node * n_threads + NumNodes() - 1) / NumNodes();
+    }
+
+    // Node holding the row of a coordinate under split model placement.
+    int NodeOfCoordinate(int coordinate, int n_coordinates) {
+	return (long long)coordinate * NumNodes() / n_coordinates;
+    }
+
+    // Pin the calling thread to a cpu of its node, or to all of the node's
+    // cpus if the node has more threads than cpus.
+    void PinThread(int thread, int n_threads) {
+#ifdef _GNU_SOURCE
+	int node = NodeOfThread(thread, n_threads);
+	const std::vector<int> &cpus = node_cpus[node];
+	int index = thread - FirstThreadOfNode(node, n_threads);
+	int n_node_threads = FirstThreadOfNode(node+1, n_threads) - FirstThreadOfNode(node, n_threads);
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	if (n_node_threads <= cpus.size()) {
+	    CPU_SET(cpus[index], &cpuset);
+	}
+	else {
+	    for (const auto &cpu : cpus) {
+		CPU_SET(cpu, &cpuset);
+	    }
+	}
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+#endif
+    }
+
+    // Place the pages of the model on the nodes, as set by
+    // FLAGS_numa_model_placement. Rows are row_stride doubles apart.
+    void PlaceModel(ModelVector &model_data, int n_coordinates, int row_stride) {
+	if (NumNodes() == 1 || model_data.empty()) return;
+#if defined(__linux__) && defined(SYS_mbind)
+	char *start = (char *)model_data.data();
+	bool placed = true;
+	if (FLAGS_numa_model_placement == "split") {
+	    for (int node = 0; node < NumNodes(); node++) {
+		size_t first_row = ((long long)node * n_coordinates + NumNodes() - 1) / NumNodes();
+		size_t end_row = ((long long)(node+1) * n_coordinates + NumNodes() - 1) / NumNodes();
+		placed &= Bind(start + first_row * row_stride * sizeof(double),
+			       start + end_row * row_stride * sizeof(double),
+			       MPOL_BIND, std::vector<int>(1, node));
+	    }
+	}
+	else if (FLAGS_numa_model_placement == "interleave") {
+	    std::vector<int> nodes(NumNodes());
+	    for (int node = 0; node < NumNodes(); node++) {
+		nodes[node] = node;
+	    }
+	    placed = Bind(start, start + model_data.size() * sizeof(double), MPOL_INTERLEAVE, nodes);
+	}
+	else {
+	    std::cerr << "NumaTopology: Unknown model placement " << FLAGS_numa_model_placement << "." << std::endl;
+	    exit(0);
+	}
+	if (!placed) {
+	    std::cerr << "NumaTopology: Could not place the model on the nodes (mbind failed), leaving it in place." << std::endl;
+	}
+#endif
+    }
+};
+
+#endif
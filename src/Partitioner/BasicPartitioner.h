@@ -28,18 +28,18 @@ class BasicPartitioner : public Partitioner {
     // split of a shuffled portion of the datapoints.
     DatapointPartitions Partition(const std::vector<Datapoint *> &datapoints, int n_threads) {
 
-	DatapointPartitions partitions(n_threads);
+	DatapointPartitions partitions(datapoints, n_threads);
 
 	// Shuffle the datapoints.
 	std::vector<Datapoint *> datapoints_copy(datapoints);
 
 	// Calculate load per thread. Then distribute.
-	int n_points_per_thread = datapoints_copy.size() / n_threads;
+	DatapointIndex n_points_per_thread = datapoints_copy.size() / n_threads;
 	for (int thread = 0; thread < n_threads; thread++) {
-	    int start = n_points_per_thread * thread;
-	    int end = n_points_per_thread * (thread+1);
+	    DatapointIndex start = n_points_per_thread * thread;
+	    DatapointIndex end = n_points_per_thread * (thread+1);
 	    if (thread == n_threads-1) end = datapoints.size();
-	    for (int datapoint_count = start; datapoint_count < end; datapoint_count++) {
+	    for (DatapointIndex datapoint_count = start; datapoint_count < end; datapoint_count++) {
 		partitions.AddDatapointToThread(datapoints_copy[datapoint_count], thread);
 	    }
 	}
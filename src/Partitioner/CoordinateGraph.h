@@ -0,0 +1,163 @@
+/*
+* Copyright 2016 [See AUTHORS file for list of authors]
+*
+*    Licensed under the Apache License, Version 2.0 (the "License");
+*    you may not use this file except in compliance with the License.
+*    You may obtain a copy of the License at
+*
+*        http://www.apache.org/licenses/LICENSE-2.0
+*
+*    Unless required by applicable law or agreed to in writing, software
+*    distributed under the License is distributed on an "AS IS" BASIS,
+*    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*    See the License for the specific language governing permissions and
+*    limitations under the License.
+*/
+
+#ifndef _COORDINATE_GRAPH_
+#define _COORDINATE_GRAPH_
+
+#include <algorithm>
+#include <vector>
+#include "../Datapoint/Datapoint.h"
+
+// The bipartite datapoint - coordinate graph of a list of datapoints, in
+// compressed sparse row form: the coordinates of datapoint d (by id, its
+// position in the list) are CoordinatesOf(d)[0, NumCoordinatesOf(d)), and the
+// ids of the datapoints touching coordinate c are
+// DatapointsOf(c)[0, NumDatapointsOf(c)), in increasing order.
+//
+// Traversals only touch these flat arrays, not the datapoints themselves.
+// Both sides are built in parallel, in passes that count and then fill.
+class CoordinateGraph {
+ private:
+    // Most blocks of coordinates the coordinate side is built by.
+    static const int MAX_BLOCKS = 4096;
+
+    DatapointIndex n_datapoints;
+    int n_coordinates;
+    std::vector<DatapointIndex> datapoint_starts, coordinate_starts;
+    std::vector<int> coordinate_ids;
+    std::vector<DatapointIndex> datapoint_ids;
+
+ public:
+    CoordinateGraph(const std::vector<Datapoint *> &datapoints, int n_threads) {
+	n_datapoints = datapoints.size();
+
+	// Datapoint side.
+	datapoint_starts.resize(n_datapoints+1);
+	datapoint_starts[0] = 0;
+	n_coordinates = 0;
+#pragma omp parallel for num_threads(n_threads) reduction(max:n_coordinates)
+	for (DatapointIndex i = 0; i < n_datapoints; i++) {
+	    const DatapointCoordinates &coordinates = datapoints[i]->GetCoordinates();
+	    datapoint_starts[i+1] = coordinates.size();
+	    for (auto const & coordinate : coordinates) {
+		n_coordinates = std::max(n_coordinates, coordinate+1);
+	    }
+	}
+	for (DatapointIndex i = 0; i < n_datapoints; i++) {
+	    datapoint_starts[i+1] += datapoint_starts[i];
+	}
+	coordinate_ids.resize(datapoint_starts[n_datapoints]);
+#pragma omp parallel for num_threads(n_threads)
+	for (DatapointIndex i = 0; i < n_datapoints; i++) {
+	    const DatapointCoordinates &coordinates = datapoints[i]->GetCoordinates();
+	    std::copy(coordinates.begin(), coordinates.end(), coordinate_ids.begin() + datapoint_starts[i]);
+	}
+
+	// Coordinate side. Every thread buckets the (coordinate, datapoint)
+	// pairs of its contiguous range of datapoints by block of coordinates,
+	// then every block is counting sorted by coordinate. Both are stable, so
+	// the lists come out in increasing id order, and neither pass scatters
+	// writes over more than a few thousand places at once.
+	int shift = 0;
+	while ((n_coordinates >> shift) >= MAX_BLOCKS) shift++;
+	int n_blocks = (n_coordinates >> shift) + 1;
+	std::vector<DatapointIndex> block_cursors((size_t)n_threads * n_blocks, 0);
+	std::vector<DatapointIndex> block_starts(n_blocks+1, 0);
+	std::vector<std::pair<int, DatapointIndex> > pairs(coordinate_ids.size());
+#pragma omp parallel num_threads(n_threads)
+	{
+	    int thread = omp_get_thread_num();
+	    DatapointIndex first = (long long)n_datapoints * thread / n_threads;
+	    DatapointIndex last = (long long)n_datapoints * (thread+1) / n_threads;
+	    DatapointIndex *cursors = &block_cursors[(size_t)thread * n_blocks];
+	    for (DatapointIndex j = datapoint_starts[first]; j < datapoint_starts[last]; j++) {
+		cursors[coordinate_ids[j] >> shift]++;
+	    }
+#pragma omp barrier
+#pragma omp single
+	    {
+		DatapointIndex offset = 0;
+		for (int b = 0; b < n_blocks; b++) {
+		    block_starts[b] = offset;
+		    for (int t = 0; t < n_threads; t++) {
+			DatapointIndex count = block_cursors[(size_t)t * n_blocks + b];
+			block_cursors[(size_t)t * n_blocks + b] = offset;
+			offset += count;
+		    }
+		}
+		block_starts[n_blocks] = offset;
+	    }
+	    for (DatapointIndex i = first; i < last; i++) {
+		for (DatapointIndex j = datapoint_starts[i]; j < datapoint_starts[i+1]; j++) {
+		    pairs[cursors[coordinate_ids[j] >> shift]++] = std::make_pair(coordinate_ids[j], i);
+		}
+	    }
+	}
+
+	coordinate_starts.resize(n_coordinates+1);
+	datapoint_ids.resize(coordinate_ids.size());
+#pragma omp parallel for num_threads(n_threads) schedule(dynamic, 1)
+	for (int b = 0; b < n_blocks; b++) {
+	    int first = b << shift, last = std::min(n_coordinates, (b+1) << shift);
+	    if (first >= last) continue;
+	    std::vector<DatapointIndex> cursors(last - first + 1, 0);
+	    for (DatapointIndex j = block_starts[b]; j < block_starts[b+1]; j++) {
+		cursors[pairs[j].first - first + 1]++;
+	    }
+	    cursors[0] = block_starts[b];
+	    for (int c = first; c < last; c++) {
+		cursors[c - first + 1] += cursors[c - first];
+		coordinate_starts[c] = cursors[c - first];
+	    }
+	    for (DatapointIndex j = block_starts[b]; j < block_starts[b+1]; j++) {
+		datapoint_ids[cursors[pairs[j].first - first]++] = pairs[j].second;
+	    }
+	}
+	coordinate_starts[n_coordinates] = coordinate_ids.size();
+    }
+    ~CoordinateGraph() {}
+
+    DatapointIndex NumDatapoints() const {
+	return n_datapoints;
+    }
+
+    // One more than the largest coordinate touched.
+    int NumCoordinates() const {
+	return n_coordinates;
+    }
+
+    DatapointIndex NumEdges() const {
+	return coordinate_ids.size();
+    }
+
+    inline DatapointIndex NumCoordinatesOf(DatapointIndex datapoint) const {
+	return datapoint_starts[datapoint+1] - datapoint_starts[datapoint];
+    }
+
+    inline const int * CoordinatesOf(DatapointIndex datapoint) const {
+	return coordinate_ids.data() + datapoint_starts[datapoint];
+    }
+
+    inline DatapointIndex NumDatapointsOf(int coordinate) const {
+	return coordinate_starts[coordinate+1] - coordinate_starts[coordinate];
+    }
+
+    inline const DatapointIndex * DatapointsOf(int coordinate) const {
+	return datapoint_ids.data() + coordinate_starts[coordinate];
+    }
+};
+
+#endif
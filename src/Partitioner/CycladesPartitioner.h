@@ -17,57 +17,252 @@
 #define _CYCLADES_PARTITIONER_
 
 DEFINE_int32(cyclades_batch_size, 5000, "Batch size for cyclades.");
+DEFINE_int32(cyclades_hub_degree, 0, "Coordinates touched by more than this many datapoints are hubs: they are left out of the cyclades conflict graph, so that they don't join every batch into one component, and their updates are applied atomically (see Updater::SetHubCoordinates). Needs a sparse SGD updater. 0 disables it.");
+DEFINE_string(cyclades_locality_order, "none", "Order of the datapoints of each cyclades batch, so that consecutive updates of a thread share model rows: none, sort (the datapoints of a component by smallest coordinate) or dfs (the datapoints of a component depth first over shared coordinates, as in DFSCachePartitioner). With sort or dfs, components are also ordered by smallest coordinate.");
 
 #include "../DatapointPartitions/DatapointPartitions.h"
 #include "Partitioner.h"
-#include <unordered_map>
+#include <limits.h>
+#include <limits>
 
 class CycladesPartitioner : public Partitioner {
 private:
     int model_size;
-    int **tree;
+    DatapointIndex **tree;
 
-    int UnionFind(int a, int *p) {
-	int root = a;
+    // Hub coordinates (see FLAGS_cyclades_hub_degree), and whether each
+    // coordinate is one (empty if there are none).
+    std::vector<int> hub_coordinates;
+    std::vector<char> hubs;
+
+    inline bool IsHub(int coordinate) const {
+	return !hubs.empty() && hubs[coordinate];
+    }
+
+    void FindHubs(const std::vector<Datapoint *> &datapoints) {
+	hub_coordinates.clear();
+	hubs.clear();
+	if (FLAGS_cyclades_hub_degree <= 0) return;
+	std::vector<DatapointIndex> degrees(model_size, 0);
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
+	    for (auto const & coordinate : datapoints[i]->GetCoordinates()) {
+		degrees[coordinate]++;
+	    }
+	}
+	hubs.resize(model_size, 0);
+	for (int coordinate = 0; coordinate < model_size; coordinate++) {
+	    if (degrees[coordinate] > FLAGS_cyclades_hub_degree) {
+		hubs[coordinate] = 1;
+		hub_coordinates.push_back(coordinate);
+	    }
+	}
+    }
+
+    DatapointIndex UnionFind(DatapointIndex a, DatapointIndex *p) {
+	DatapointIndex root = a;
 	while (p[a] != a) {
 	    a = p[a];
 	}
 	while (root != a) {
-	    int root2 = p[root];
+	    DatapointIndex root2 = p[root];
 	    p[root] = a;
 	    root = root2;
 	}
 	return a;
     }
 
-    void ComputeCC(const std::vector<Datapoint *> & datapoints, int start_index, int end_index,
-		   std::unordered_map<int, std::vector<Datapoint *>> &components, int *tree) {
+    // Connected components of a batch: its datapoints grouped by component,
+    // component c being datapoints [offsets[c], offsets[c+1]).
+    struct BatchComponents {
+	std::vector<Datapoint *> datapoints;
+	std::vector<int> offsets;
+
+	int NumComponents() const {
+	    return offsets.size()-1;
+	}
+    };
+
+    void ComputeCC(const std::vector<Datapoint *> & datapoints, DatapointIndex start_index, DatapointIndex end_index,
+		   BatchComponents &components, DatapointIndex *tree) {
 	// Initialize tree for union find.
-	for (int i = 0; i < model_size + FLAGS_cyclades_batch_size; i++) {
+	for (DatapointIndex i = 0; i < TreeSize(); i++) {
 	    tree[i] = i;
 	}
 
 	// CC Computation.
-	for (int i = start_index; i < end_index; i++) {
+	for (DatapointIndex i = start_index; i < end_index; i++) {
 	    Datapoint *point = datapoints[i];
-	    int target = UnionFind(i-start_index, tree);
+	    DatapointIndex target = UnionFind(i-start_index, tree);
 	    for (auto const & coordinate : point->GetCoordinates()) {
-		int coordinate_src = UnionFind(coordinate + end_index-start_index, tree);
+		if (IsHub(coordinate)) continue;
+		DatapointIndex coordinate_src = UnionFind(coordinate + end_index-start_index, tree);
 		tree[coordinate_src] = target;
 	    }
 	}
 
-	for (int i = 0; i < end_index-start_index; i++) {
-	    components[UnionFind(i, tree)].push_back(datapoints[i+start_index]);
+	// Every root is a datapoint. Relabel the roots 0, 1, ... in order of
+	// first appearance, then counting sort the datapoints by label.
+	int n_datapoints = end_index-start_index;
+	std::vector<int> labels(n_datapoints, -1), datapoint_labels(n_datapoints);
+	components.offsets.assign(1, 0);
+	for (int i = 0; i < n_datapoints; i++) {
+	    DatapointIndex root = UnionFind(i, tree);
+	    if (labels[root] < 0) {
+		labels[root] = components.offsets.size()-1;
+		components.offsets.push_back(0);
+	    }
+	    datapoint_labels[i] = labels[root];
+	    components.offsets[labels[root]+1]++;
+	}
+	for (int c = 0; c < components.NumComponents(); c++) {
+	    components.offsets[c+1] += components.offsets[c];
 	}
+	std::vector<int> cursors(components.offsets.begin(), components.offsets.end()-1);
+	components.datapoints.resize(n_datapoints);
+	for (int i = 0; i < n_datapoints; i++) {
+	    components.datapoints[cursors[datapoint_labels[i]]++] = datapoints[i+start_index];
+	}
+    }
+
+    static int SmallestCoordinate(Datapoint *datapoint) {
+	const DatapointCoordinates &coordinates = datapoint->GetCoordinates();
+	return coordinates.empty() ? INT_MAX : *std::min_element(coordinates.begin(), coordinates.end());
+    }
+
+    // Order the datapoints of every component depth first over the
+    // datapoint - coordinate graph of the batch (without hubs, which would
+    // lead out of the component), from the first datapoint of the component.
+    void OrderComponentsDFS(BatchComponents &components) {
+	std::vector<Datapoint *> &datapoints = components.datapoints;
+	int n_datapoints = datapoints.size();
+
+	// Datapoints touching each coordinate: (coordinate, datapoint) pairs
+	// sorted by coordinate, each distinct coordinate owning a range.
+	std::vector<std::pair<int, int> > touches;
+	for (int i = 0; i < n_datapoints; i++) {
+	    for (auto const & coordinate : datapoints[i]->GetCoordinates()) {
+		if (IsHub(coordinate)) continue;
+		touches.push_back(std::make_pair(coordinate, i));
+	    }
+	}
+	std::sort(touches.begin(), touches.end());
+	std::vector<int> coordinates, coordinate_starts;
+	for (int i = 0; i < touches.size(); i++) {
+	    if (i == 0 || touches[i].first != touches[i-1].first) {
+		coordinates.push_back(touches[i].first);
+		coordinate_starts.push_back(i);
+	    }
+	}
+	coordinate_starts.push_back(touches.size());
+
+	std::vector<char> visited_datapoints(n_datapoints, 0), visited_coordinates(coordinates.size(), 0);
+	std::vector<Datapoint *> ordered;
+	ordered.reserve(n_datapoints);
+	std::vector<int> dfs_stack;
+	for (int c = 0; c < components.NumComponents(); c++) {
+	    dfs_stack.push_back(components.offsets[c]);
+	    while (!dfs_stack.empty()) {
+		int cur = dfs_stack.back();
+		dfs_stack.pop_back();
+		if (visited_datapoints[cur]) {
+		    continue;
+		}
+		visited_datapoints[cur] = 1;
+		ordered.push_back(datapoints[cur]);
+		const DatapointCoordinates &cur_coordinates = datapoints[cur]->GetCoordinates();
+		for (int j = cur_coordinates.size()-1; j >= 0; j--) {
+		    if (IsHub(cur_coordinates[j])) continue;
+		    int index = std::lower_bound(coordinates.begin(), coordinates.end(), cur_coordinates[j]) - coordinates.begin();
+		    if (visited_coordinates[index]) continue;
+		    visited_coordinates[index] = 1;
+		    for (int k = coordinate_starts[index+1]-1; k >= coordinate_starts[index]; k--) {
+			if (!visited_datapoints[touches[k].second]) {
+			    dfs_stack.push_back(touches[k].second);
+			}
+		    }
+		}
+	    }
+	}
+	datapoints.swap(ordered);
+    }
+
+    // Order the batch's datapoints as set by FLAGS_cyclades_locality_order,
+    // keeping components contiguous.
+    void OrderForLocality(BatchComponents &components) {
+	if (FLAGS_cyclades_locality_order == "none") return;
+	if (FLAGS_cyclades_locality_order == "dfs") {
+	    OrderComponentsDFS(components);
+	}
+	else if (FLAGS_cyclades_locality_order == "sort") {
+	    for (int c = 0; c < components.NumComponents(); c++) {
+		std::stable_sort(components.datapoints.begin() + components.offsets[c],
+				 components.datapoints.begin() + components.offsets[c+1],
+				 [](Datapoint *a, Datapoint *b) { return SmallestCoordinate(a) < SmallestCoordinate(b); });
+	    }
+	}
+	else {
+	    std::cerr << "CycladesPartitioner: Unknown locality order " << FLAGS_cyclades_locality_order << "." << std::endl;
+	    exit(0);
+	}
+
+	// Components by smallest coordinate, so that those given to a thread
+	// in turn touch nearby rows.
+	std::vector<std::pair<int, int> > keys(components.NumComponents());
+	for (int c = 0; c < components.NumComponents(); c++) {
+	    int smallest = INT_MAX;
+	    for (int i = components.offsets[c]; i < components.offsets[c+1]; i++) {
+		smallest = std::min(smallest, SmallestCoordinate(components.datapoints[i]));
+	    }
+	    keys[c] = std::make_pair(smallest, c);
+	}
+	std::sort(keys.begin(), keys.end());
+	BatchComponents ordered;
+	ordered.offsets.push_back(0);
+	ordered.datapoints.reserve(components.datapoints.size());
+	for (auto const & key : keys) {
+	    int c = key.second;
+	    ordered.datapoints.insert(ordered.datapoints.end(),
+				      components.datapoints.begin() + components.offsets[c],
+				      components.datapoints.begin() + components.offsets[c+1]);
+	    ordered.offsets.push_back(ordered.datapoints.size());
+	}
+	std::swap(components, ordered);
+    }
+
+    // Give a component to a thread of the NUMA node holding most of the model
+    // rows it touches (under split model placement), if that keeps the
+    // threads of the batch balanced enough.
+    void AddToNodeOfComponent(DatapointPartitions &partitions, Datapoint * const *component, int size, int n_threads) {
+	NumaTopology &topology = NumaTopology::Get();
+	std::vector<int> rows_on_node(topology.NumNodes(), 0);
+	for (int i = 0; i < size; i++) {
+	    for (auto const & coordinate : component[i]->GetCoordinates()) {
+		rows_on_node[topology.NodeOfCoordinate(coordinate, model_size)]++;
+	    }
+	}
+	int node = std::max_element(rows_on_node.begin(), rows_on_node.end()) - rows_on_node.begin();
+	int slack = FLAGS_numa_component_imbalance * FLAGS_cyclades_batch_size / n_threads;
+	partitions.AddDatapointsToLeastLoadedThreadIn(component, size,
+						      topology.FirstThreadOfNode(node, n_threads),
+						      topology.FirstThreadOfNode(node+1, n_threads),
+						      slack);
+    }
+
+    // Union find nodes: the datapoints of a batch, then the coordinates.
+    DatapointIndex TreeSize() const {
+	return (DatapointIndex)model_size + FLAGS_cyclades_batch_size;
     }
 
 public:
     CycladesPartitioner(Model *model) : Partitioner() {
 	model_size = model->NumParameters();
-	tree = new int *[FLAGS_n_threads];
+	if ((long long)model_size + FLAGS_cyclades_batch_size > std::numeric_limits<DatapointIndex>::max()) {
+	    std::cerr << "CycladesPartitioner: Model size plus batch size overflows the index type, build with INDEX_64." << std::endl;
+	    exit(0);
+	}
+	tree = new DatapointIndex *[FLAGS_n_threads];
 	for (int i = 0; i < FLAGS_n_threads; i++) {
-	    tree[i] = new int[model_size + FLAGS_cyclades_batch_size];
+	    tree[i] = new DatapointIndex[TreeSize()];
 	}
     }
     ~CycladesPartitioner() {
@@ -81,7 +276,8 @@ public:
     // split of a shuffled portion of the datapoints.
     DatapointPartitions Partition(const std::vector<Datapoint *> &datapoints, int n_threads) {
 
-	DatapointPartitions partitions(n_threads);
+	DatapointPartitions partitions(datapoints, n_threads);
+	FindHubs(datapoints);
 
 	// Shuffle the datapoints.
 	std::vector<Datapoint *> datapoints_copy(datapoints);
@@ -90,31 +286,48 @@ public:
 	int num_total_batches = ceil((double)datapoints_copy.size() / (double)FLAGS_cyclades_batch_size);
 
 	// Process FLAGS_cyclades_batch_size pointer per iteration, computing CCS on them.
-	std::vector<std::unordered_map<int, std::vector<Datapoint *>>> components(num_total_batches);
+	std::vector<BatchComponents> components(num_total_batches);
 	#pragma omp parallel for
-	for (int datapoint_count = 0; datapoint_count < datapoints_copy.size(); datapoint_count += FLAGS_cyclades_batch_size) {
+	for (DatapointIndex datapoint_count = 0; datapoint_count < datapoints_copy.size(); datapoint_count += FLAGS_cyclades_batch_size) {
 	    // Current batch index.
 	    int batch_index = datapoint_count / FLAGS_cyclades_batch_size;
-	    int start = datapoint_count;
-	    int end = std::min(datapoint_count + FLAGS_cyclades_batch_size, (int)datapoints_copy.size());
+	    DatapointIndex start = datapoint_count;
+	    DatapointIndex end = std::min(datapoint_count + FLAGS_cyclades_batch_size, (DatapointIndex)datapoints_copy.size());
 
 	    // Compute components.
 	    ComputeCC(datapoints_copy, start, end,
 		      components[batch_index],
 		      tree[omp_get_thread_num()]);
+	    OrderForLocality(components[batch_index]);
 	}
 
 	// Load balance the connected components (load balance within the batch, not across it).
+	bool steer_to_nodes = FLAGS_numa_placement && FLAGS_numa_model_placement == "split" &&
+	    NumaTopology::Get().NumNodes() > 1;
 	for (int batch = 0; batch < num_total_batches; batch++) {
-	    for (std::unordered_map<int, std::vector<Datapoint *>>::iterator it = components[batch].begin();
-		 it != components[batch].end(); it++) {
-		partitions.AddDatapointsToLeastLoadedThread(it->second);
+	    BatchComponents &batch_components = components[batch];
+	    for (int c = 0; c < batch_components.NumComponents(); c++) {
+		Datapoint * const *component = batch_components.datapoints.data() + batch_components.offsets[c];
+		int size = batch_components.offsets[c+1] - batch_components.offsets[c];
+		if (steer_to_nodes) {
+		    AddToNodeOfComponent(partitions, component, size, n_threads);
+		}
+		else {
+		    partitions.AddDatapointsToLeastLoadedThread(component, size);
+		}
 	    }
+	    // Free the batch's components as they are distributed.
+	    std::vector<Datapoint *>().swap(batch_components.datapoints);
 	    partitions.StartNewBatch();
 	}
 
 	return partitions;
     }
+
+    // Coordinates left out of the conflict graph by the last Partition.
+    const std::vector<int> &HubCoordinates() const {
+	return hub_coordinates;
+    }
 };
 
 #endif
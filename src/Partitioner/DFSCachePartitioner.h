@@ -16,74 +16,106 @@
 #ifndef _DFSCUTSGRAPHPARTITIONER_
 #define _DFSCUTSGRAPHPARTITIONER_
 
+#include <atomic>
 #include "Partitioner.h"
+#include "CoordinateGraph.h"
 
+// Orders the datapoints depth first over the datapoint - coordinate graph, so
+// that consecutive datapoints share coordinates, and gives each thread an
+// equal, contiguous share of the order.
+//
+// The traversal is parallel: each thread runs DFS seeded from the datapoints
+// of its own contiguous range of ids, claiming datapoints and coordinates
+// through atomic visited flags, so that every datapoint is visited by exactly
+// one thread. The threads' visit orders are then concatenated and split up.
 class DFSCachePartitioner : public Partitioner {
- public:
-    DFSCachePartitioner() {};
-    ~DFSCachePartitioner() {};
+ private:
+    // DFS stack entry: a datapoint (by id) or a coordinate, and the position
+    // of the next of its neighbors to try.
+    struct Frame {
+	bool is_coordinate;
+	DatapointIndex node;
+	DatapointIndex next;
+    };
 
-    // Assumptions: datapoints orders (id) are continuous and in order.
-    DatapointPartitions Partition(const std::vector<Datapoint *> &datapoints, int n_threads) {
-	// Number of datapoints. To be used as graph node id offset.
-	int n_datapoints = datapoints.size();
+    static inline bool Claim(std::atomic<char> &visited) {
+	return !visited.load(std::memory_order_relaxed) &&
+	    !visited.exchange(1, std::memory_order_relaxed);
+    }
 
-	// Count the number of nodes. This is relatively very fast so it's not a problem
-	// that it's taking an extra loop.
-	int n_nodes = 0, avg_n_neighbors = 0;
-	for (int i = 0; i < datapoints.size(); i++) {
-	    int datapoint_id = datapoints[i]->GetOrder() - 1;
-	    avg_n_neighbors += datapoints[i]->GetCoordinates().size();
-	    for (const auto & coordinate : datapoints[i]->GetCoordinates()) {
-		int coordinate_id = coordinate + n_datapoints;
-		n_nodes = fmax(n_nodes, coordinate_id);
+    // DFS from every unclaimed datapoint of [seed_start, seed_end), appending
+    // the datapoints this thread claims to order, in visit order.
+    void Traverse(const CoordinateGraph &graph,
+		  DatapointIndex seed_start, DatapointIndex seed_end,
+		  std::vector<std::atomic<char> > &visited_datapoints,
+		  std::vector<std::atomic<char> > &visited_coordinates,
+		  std::vector<DatapointIndex> &order) {
+	std::vector<Frame> dfs_stack;
+	for (DatapointIndex seed = seed_start; seed < seed_end; seed++) {
+	    if (!Claim(visited_datapoints[seed])) continue;
+	    order.push_back(seed);
+	    dfs_stack.push_back(Frame{false, seed, 0});
+	    while (!dfs_stack.empty()) {
+		Frame &top = dfs_stack.back();
+		if (top.is_coordinate) {
+		    const DatapointIndex *neighbors = graph.DatapointsOf(top.node);
+		    DatapointIndex degree = graph.NumDatapointsOf(top.node);
+		    while (top.next < degree && !Claim(visited_datapoints[neighbors[top.next]])) {
+			top.next++;
+		    }
+		    if (top.next == degree) {
+			dfs_stack.pop_back();
+			continue;
+		    }
+		    DatapointIndex datapoint = neighbors[top.next++];
+		    order.push_back(datapoint);
+		    dfs_stack.push_back(Frame{false, datapoint, 0});
+		}
+		else {
+		    const int *coordinates = graph.CoordinatesOf(top.node);
+		    DatapointIndex degree = graph.NumCoordinatesOf(top.node);
+		    while (top.next < degree && !Claim(visited_coordinates[coordinates[top.next]])) {
+			top.next++;
+		    }
+		    if (top.next == degree) {
+			dfs_stack.pop_back();
+			continue;
+		    }
+		    int coordinate = coordinates[top.next++];
+		    dfs_stack.push_back(Frame{true, coordinate, 0});
+		}
 	    }
 	}
-	n_nodes++;
-	avg_n_neighbors /= n_datapoints;
+    }
 
-	// Create the graph.
-	std::vector<std::vector<int> > graph(n_nodes+1);
-	for (int i = 0; i < graph.size(); i++) {
-	    graph[i].reserve(avg_n_neighbors);
-	}
-	for (int i = 0; i < datapoints.size(); i++) {
-	    int datapoint_id = datapoints[i]->GetOrder() - 1;
-	    for (const auto & coordinate : datapoints[i]->GetCoordinates()) {
-		int coordinate_id = coordinate + n_datapoints;
-		graph[datapoint_id].push_back(coordinate_id);
-		graph[coordinate_id].push_back(datapoint_id);
-	    }
-	}
+ public:
+    DFSCachePartitioner() {};
+    ~DFSCachePartitioner() {};
 
-	DatapointPartitions partitions(n_threads);
-	int n_points_per_thread = datapoints.size() / n_threads + 1;
-	int n_nodes_processed_so_far = 0;
+    // Assumptions: datapoints orders (id) are continuous and in order.
+    DatapointPartitions Partition(const std::vector<Datapoint *> &datapoints, int n_threads) {
+	DatapointIndex n_datapoints = datapoints.size();
+	CoordinateGraph graph(datapoints, n_threads);
 
-	// Perform dfs on the graph.
-	std::vector<int> dfs_stack;
-	dfs_stack.reserve(n_nodes);
-	std::vector<char> visited(n_nodes);
-	std::fill(visited.begin(), visited.end(), 0);
-	for (int i = 0; i < datapoints.size(); i++) {
-	    dfs_stack.push_back(datapoints[i]->GetOrder()-1);
+	std::vector<std::atomic<char> > visited_datapoints(n_datapoints);
+	std::vector<std::atomic<char> > visited_coordinates(graph.NumCoordinates());
+	std::vector<std::vector<DatapointIndex> > orders(n_threads);
+#pragma omp parallel num_threads(n_threads)
+	{
+	    int thread = omp_get_thread_num();
+	    DatapointIndex seed_start = (long long)n_datapoints * thread / n_threads;
+	    DatapointIndex seed_end = (long long)n_datapoints * (thread+1) / n_threads;
+	    orders[thread].reserve(seed_end - seed_start);
+	    Traverse(graph, seed_start, seed_end,
+		     visited_datapoints, visited_coordinates, orders[thread]);
 	}
 
-	int n_datapoints_added = 0;
-	while (!dfs_stack.empty()) {
-	    int cur_node = dfs_stack[dfs_stack.size()-1];
-	    dfs_stack.pop_back();
-	    if (visited[cur_node]) {
-		continue;
-	    }
-	    visited[cur_node] = 1;
-	    if (cur_node < n_datapoints) {
-		int cur_assigned_thread = n_nodes_processed_so_far++ / n_points_per_thread;
-		partitions.AddDatapointToThread(datapoints[cur_node], cur_assigned_thread);
-		n_datapoints_added++;
-	    }
-	    for (auto const & neighbor : graph[cur_node]) {
-		dfs_stack.push_back(neighbor);
+	DatapointPartitions partitions(datapoints, n_threads);
+	DatapointIndex n_points_per_thread = n_datapoints / n_threads + 1;
+	DatapointIndex n_datapoints_added = 0;
+	for (auto const & order : orders) {
+	    for (auto const & id : order) {
+		partitions.AddDatapointToThread(datapoints[id], n_datapoints_added++ / n_points_per_thread);
 	    }
 	}
 
@@ -16,13 +16,18 @@
 #ifndef _GREEDY_PARTITIONER_
 #define _GREEDY_PARTITIONER_
 
+#include <stdint.h>
+#include <atomic>
 #include <unordered_map>
 #include <vector>
 
 #include "Partitioner.h"
 
 DEFINE_bool(greedy_naive_exact, false, "Use the O(kn^2) exact greedy algorithm.");
-DEFINE_bool(greedy_lsh_approximate, true, "Use hamming distance locality sensitive hashing approximate greedy method.");
+DEFINE_bool(greedy_lsh_approximate, true, "Use the MinHash locality sensitive hashing approximate greedy method (parallel).");
+DEFINE_int32(greedy_lsh_bands, 4, "For the LSH greedy method, number of bands of the MinHash signature (more finds more candidates).");
+DEFINE_int32(greedy_lsh_rows, 1, "For the LSH greedy method, number of minhashes per band (more makes candidates more similar).");
+DEFINE_int32(greedy_lsh_window, 2, "For the LSH greedy method, most candidates taken on either side of a datapoint in each band's bucket.");
 
 class GreedyCachePartitioner : public Partitioner {
  protected:
@@ -40,10 +45,11 @@ class GreedyCachePartitioner : public Partitioner {
     void FindDatapointWithMaximumOverlap(Datapoint *datapoint,
 					 std::unordered_map<int, bool> &coords,
 					 const std::vector<Datapoint *> &datapoints,
-					 int &max_overlap, int &index_of_result,
-					 std::unordered_map<int, bool> &used_datapoints) {
-	int best_overlap = -1, best_index = -1;
-	for (int i = 0; i < datapoints.size(); i++) {
+					 int &max_overlap, DatapointIndex &index_of_result,
+					 std::unordered_map<DatapointIndex, bool> &used_datapoints) {
+	int best_overlap = -1;
+	DatapointIndex best_index = -1;
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
 	    if (datapoints[i] != datapoint &&
 		used_datapoints.find(i) == used_datapoints.end()) {
 		int cur_overlap = CalculateOverlap(coords, datapoints[i]);
@@ -57,24 +63,25 @@ class GreedyCachePartitioner : public Partitioner {
 	index_of_result = best_index;
     }
 
-    DatapointPartitions NaiveExact(const std::vector<Datapoint *> &datapoints, int n_threads) {
+    std::vector<DatapointIndex> NaiveExact(const std::vector<Datapoint *> &datapoints) {
 	// Keep track of a map of distinct coordinate accesses accessed by datapoint.
 	std::vector<std::unordered_map<int, bool> > datapoint_coordinate_accesses(datapoints.size());
-	for (int i = 0; i < datapoints.size(); i++) {
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
 	    for (const auto &coordinate : datapoints[i]->GetCoordinates()) {
 		datapoint_coordinate_accesses[i][coordinate] = 1;
 	    }
 	}
 
 	// Note the cache permutation stores the indices of the elements.
-	std::vector<int> cache_permutation;
-	std::unordered_map<int, bool> used_datapoints;
+	std::vector<DatapointIndex> cache_permutation;
+	std::unordered_map<DatapointIndex, bool> used_datapoints;
 
 	// Find the pair of datapoints that produces the best overlap.
-	int global_max_overlap = 0, best_first, best_second;
-	for (int i = 0; i < datapoints.size(); i++) {
+	int global_max_overlap = 0;
+	DatapointIndex best_first, best_second;
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
 	    int cur_max_overlap = 0;
-	    int index_of_second_datapoint = 0;
+	    DatapointIndex index_of_second_datapoint = 0;
 	    FindDatapointWithMaximumOverlap(datapoints[i], datapoint_coordinate_accesses[i],
 					    datapoints, cur_max_overlap, index_of_second_datapoint, used_datapoints);
 	    if (cur_max_overlap > global_max_overlap) {
@@ -88,9 +95,9 @@ class GreedyCachePartitioner : public Partitioner {
 	used_datapoints[best_second] = 1;
 
 	// Greedly append datapoint that produces best overlap.
-	for (int i = 2; i < datapoints.size(); i++) {
+	for (DatapointIndex i = 2; i < datapoints.size(); i++) {
 	    int max_overlap = 0;
-	    int next_index = 0;
+	    DatapointIndex next_index = 0;
 	    FindDatapointWithMaximumOverlap(datapoints[cache_permutation[i-1]],
 					    datapoint_coordinate_accesses[cache_permutation[i-1]],
 					    datapoints, max_overlap, next_index, used_datapoints);
@@ -103,91 +110,182 @@ class GreedyCachePartitioner : public Partitioner {
 	    exit(0);
 	}
 
-	// Number of datapoints. To be used as graph node id offset.
-	int n_datapoints = datapoints.size();
-	DatapointPartitions partitions(n_threads);
+	return cache_permutation;
+    }
+
+    // 64 bit mix (splitmix64 finalizer), hashing value under seed.
+    static inline uint64_t Mix(uint64_t value, uint64_t seed) {
+	uint64_t z = value + seed * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+    }
+
+    // Claim a datapoint for the calling thread's chain.
+    static inline bool Claim(std::atomic<char> &claimed) {
+	return !claimed.load(std::memory_order_relaxed) &&
+	    !claimed.exchange(1, std::memory_order_relaxed);
+    }
 
-	for (int i = 0; i < datapoints.size(); i++) {
-	    partitions.AddDatapointToThread(datapoints[cache_permutation[i]], 0);
+    // Stable LSD radix sort of (key, datapoint) pairs by key, a byte at a time.
+    static void RadixSortByKey(std::vector<std::pair<uint32_t, DatapointIndex> > &items) {
+	std::vector<std::pair<uint32_t, DatapointIndex> > buffer(items.size());
+	for (int shift = 0; shift < 32; shift += 8) {
+	    DatapointIndex starts[257] = {0};
+	    for (auto const & item : items) {
+		starts[((item.first >> shift) & 0xFF) + 1]++;
+	    }
+	    for (int digit = 0; digit < 256; digit++) {
+		starts[digit+1] += starts[digit];
+	    }
+	    for (auto const & item : items) {
+		buffer[starts[(item.first >> shift) & 0xFF]++] = item;
+	    }
+	    items.swap(buffer);
 	}
+    }
 
+    // Give each thread an equal, contiguous share of the permutation.
+    DatapointPartitions Distribute(const std::vector<Datapoint *> &datapoints,
+				   const std::vector<DatapointIndex> &permutation, int n_threads) {
+	DatapointPartitions partitions(datapoints, n_threads);
+	DatapointIndex n_points_per_thread = datapoints.size() / n_threads + 1;
+	for (DatapointIndex i = 0; i < permutation.size(); i++) {
+	    partitions.AddDatapointToThread(datapoints[permutation[i]], i / n_points_per_thread);
+	}
 	return partitions;
     }
 
-    DatapointPartitions LSHApproximate(const std::vector<Datapoint *> &datapoints, int n_threads) {
+    // Greedy ordering over MinHash LSH candidates.
+    //
+    // Each datapoint gets a signature of bands * rows minhashes of its
+    // coordinates; two datapoints agree on a minhash with probability the
+    // Jaccard similarity of their coordinates. For every band, datapoints are
+    // sorted by the hash of their rows of the signature, so the datapoints
+    // sharing a bucket are contiguous.
+    //
+    // The order is built by chaining: from the current datapoint, go to the
+    // unclaimed datapoint sharing a bucket with it in the most bands (looking
+    // at up to FLAGS_greedy_lsh_window of them on either side in each band,
+    // among the nearest 4 * FLAGS_greedy_lsh_window),
+    // or, if there is none, start a new chain from the next unclaimed seed.
+    // Chains are built in parallel, each thread seeding from its own
+    // contiguous range of datapoints and claiming datapoints through atomic
+    // flags, and then concatenated.
+    std::vector<DatapointIndex> LSHApproximate(const std::vector<Datapoint *> &datapoints, int n_threads) {
+	DatapointIndex n_datapoints = datapoints.size();
+	int n_bands = FLAGS_greedy_lsh_bands, n_rows = FLAGS_greedy_lsh_rows;
+	int n_hashes = n_bands * n_rows;
+	if (n_bands <= 0 || n_rows <= 0) {
+	    std::cerr << "GreedyCachePartitioner: greedy_lsh_bands and greedy_lsh_rows must be positive." << std::endl;
+	    exit(0);
+	}
 
-	// Construct a hash table for datapoints for hamming distance.
-	std::unordered_map<int, std::set<Datapoint *> > h_table;
-	for (const auto & datapoint : datapoints) {
-	    int hash = datapoint->GetCoordinates()[rand() % datapoint->GetCoordinates().size()];
-	    h_table[hash].insert(datapoint);
+	// Signatures.
+	std::vector<uint32_t> signatures((size_t)n_datapoints * n_hashes);
+#pragma omp parallel for num_threads(n_threads)
+	for (DatapointIndex i = 0; i < n_datapoints; i++) {
+	    uint32_t *signature = &signatures[(size_t)i * n_hashes];
+	    for (int k = 0; k < n_hashes; k++) {
+		uint32_t min_hash = UINT32_MAX;
+		for (auto const & coordinate : datapoints[i]->GetCoordinates()) {
+		    min_hash = std::min(min_hash, (uint32_t)Mix(coordinate, k+1));
+		}
+		signature[k] = min_hash;
+	    }
 	}
 
-	// Construct maps for every datapoint.
-	std::vector<std::unordered_map<int, bool> > datapoint_coordinate_accesses(datapoints.size());
-	for (int i = 0; i < datapoints.size(); i++) {
-	    datapoints[i]->SetOrder(i);
-	    for (const auto &coordinate : datapoints[i]->GetCoordinates()) {
-		datapoint_coordinate_accesses[i][coordinate] = 1;
+	// Buckets: per band, the datapoints sorted by the (32 bit) hash of their
+	// rows, and the position of each datapoint in every band's order, with
+	// the positions of a datapoint side by side.
+	std::vector<std::vector<std::pair<uint32_t, DatapointIndex> > > bands(n_bands);
+	std::vector<DatapointIndex> positions((size_t)n_datapoints * n_bands);
+#pragma omp parallel for num_threads(n_threads) schedule(dynamic, 1)
+	for (int band = 0; band < n_bands; band++) {
+	    std::vector<std::pair<uint32_t, DatapointIndex> > &sorted = bands[band];
+	    sorted.resize(n_datapoints);
+	    for (DatapointIndex i = 0; i < n_datapoints; i++) {
+		uint64_t key = band;
+		for (int row = 0; row < n_rows; row++) {
+		    key = Mix(key ^ signatures[(size_t)i * n_hashes + band * n_rows + row], row+1);
+		}
+		sorted[i] = std::make_pair((uint32_t)key, i);
+	    }
+	    RadixSortByKey(sorted);
+	    for (DatapointIndex i = 0; i < n_datapoints; i++) {
+		positions[(size_t)sorted[i].second * n_bands + band] = i;
 	    }
 	}
+	std::vector<uint32_t>().swap(signatures);
+
+	// Chains.
+	std::vector<std::atomic<char> > claimed(n_datapoints);
+	std::vector<std::vector<DatapointIndex> > chains(n_threads);
+	int window = FLAGS_greedy_lsh_window;
+#pragma omp parallel num_threads(n_threads)
+	{
+	    int thread = omp_get_thread_num();
+	    DatapointIndex seed_start = (long long)n_datapoints * thread / n_threads;
+	    DatapointIndex seed_end = (long long)n_datapoints * (thread+1) / n_threads;
+	    std::vector<DatapointIndex> &chain = chains[thread];
+	    chain.reserve(seed_end - seed_start);
+	    std::vector<DatapointIndex> candidates;
+	    std::vector<std::pair<int, DatapointIndex> > ranked;
+	    for (DatapointIndex seed = seed_start; seed < seed_end; seed++) {
+		if (!Claim(claimed[seed])) continue;
+		DatapointIndex cur = seed;
+		while (true) {
+		    chain.push_back(cur);
 
-	// Construct a map for every available datapoint index.
-	std::set<int> available;
-	for (int i = 0; i < datapoints.size(); i++) {
-	    available.insert(i);
-	}
-
-	int retry_limit = 100;
-
-	// Do greedy algorithm with a random starting point;
-	std::vector<Datapoint *> permutation(datapoints.size());
-	for (int i = 0; i < datapoints.size(); i++) {
-	    Datapoint *cur = NULL, *next = NULL;
-	    int best_overlap = -1;
-	    int n_tries = 0;
-	    int coordinate_index = 0;
-	    if (i != 0) {
-		cur = permutation[i-1];
-		//while (next == NULL) {
-		for (int j = 0; j < retry_limit; j++) {
-		    int hash = cur->GetCoordinates()[coordinate_index++];
-		    if (h_table.find(hash) != h_table.end()) {
-			for (const auto & similar_datapoint : h_table[hash]) {
-			    int overlap = CalculateOverlap(datapoint_coordinate_accesses[cur->GetOrder()],
-							   similar_datapoint);
-			    if (overlap > best_overlap) {
-				next = similar_datapoint;
-				best_overlap = overlap;
+		    // Unclaimed datapoints sharing a bucket with cur, once per band shared.
+		    candidates.clear();
+		    for (int band = 0; band < n_bands; band++) {
+			const std::vector<std::pair<uint32_t, DatapointIndex> > &sorted = bands[band];
+			DatapointIndex position = positions[(size_t)cur * n_bands + band];
+			uint32_t key = sorted[position].first;
+			for (int direction = -1; direction <= 1; direction += 2) {
+			    int found = 0;
+			    for (DatapointIndex j = position + direction;
+				 j >= 0 && j < n_datapoints && sorted[j].first == key &&
+				     found < window && (j - position) * direction <= 4 * window;
+				 j += direction) {
+				if (!claimed[sorted[j].second].load(std::memory_order_relaxed)) {
+				    candidates.push_back(sorted[j].second);
+				    found++;
+				}
 			    }
 			}
-			if (next != NULL) {
-			    h_table[hash].erase(next);
-			}
-			else {
-			    if (n_tries++ > retry_limit) {
-				break;
-			    }
+		    }
+
+		    // Most shared bands first, then smallest id.
+		    std::sort(candidates.begin(), candidates.end());
+		    ranked.clear();
+		    for (size_t j = 0; j < candidates.size(); ) {
+			size_t k = j;
+			while (k < candidates.size() && candidates[k] == candidates[j]) k++;
+			ranked.push_back(std::make_pair(-(int)(k - j), candidates[j]));
+			j = k;
+		    }
+		    std::sort(ranked.begin(), ranked.end());
+		    DatapointIndex next = -1;
+		    for (auto const & candidate : ranked) {
+			if (Claim(claimed[candidate.second])) {
+			    next = candidate.second;
+			    break;
 			}
 		    }
+		    if (next < 0) break;
+		    cur = next;
 		}
 	    }
-	    if (next == NULL) {
-		next = datapoints[*available.begin()];
-	    }
-	    permutation[i] = next;
-	    available.erase(next->GetOrder());
 	}
 
-	// Distribute permutation.
-	int n_datapoints = datapoints.size();
-	DatapointPartitions partitions(n_threads);
-
-	for (int i = 0; i < datapoints.size(); i++) {
-	    partitions.AddDatapointToThread(permutation[i], 0);
+	std::vector<DatapointIndex> permutation;
+	permutation.reserve(n_datapoints);
+	for (auto const & chain : chains) {
+	    permutation.insert(permutation.end(), chain.begin(), chain.end());
 	}
-
-	return partitions;
+	return permutation;
     }
 
  public:
@@ -196,22 +294,23 @@ class GreedyCachePartitioner : public Partitioner {
 
     // Assumptions: datapoints orders (id) are continuous and in order.
     DatapointPartitions Partition(const std::vector<Datapoint *> &datapoints, int n_threads) {
-	// This only works for 1 thread for now!
-	if (FLAGS_n_threads > 1) {
-	    std::cout << "GreedyCachePartitioner.h: Only 1 threaded is valid for now." << std::endl;
-	    exit(0);
-	}
-
+	std::vector<DatapointIndex> permutation;
 	if (FLAGS_greedy_naive_exact) {
-	    return NaiveExact(datapoints, n_threads);
+	    permutation = NaiveExact(datapoints);
 	}
 	else if (FLAGS_greedy_lsh_approximate) {
-	    return LSHApproximate(datapoints, n_threads);
+	    permutation = LSHApproximate(datapoints, n_threads);
 	}
 	else {
 	    std::cout << "GreedyCachePartitioner.h: No greedy method chosen." << std::endl;
 	    exit(0);
 	}
+
+	if (permutation.size() != datapoints.size()) {
+	    std::cout << "GreedyCachePartitioner.h: Error, datapoints don't add up - " << permutation.size() << " - " << datapoints.size() << std::endl;
+	    exit(0);
+	}
+	return Distribute(datapoints, permutation, n_threads);
     }
 };
 
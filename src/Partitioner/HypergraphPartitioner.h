@@ -0,0 +1,398 @@
+/*
+* Copyright 2016 [See AUTHORS file for list of authors]
+*
+*    Licensed under the Apache License, Version 2.0 (the "License");
+*    you may not use this file except in compliance with the License.
+*    You may obtain a copy of the License at
+*
+*        http://www.apache.org/licenses/LICENSE-2.0
+*
+*    Unless required by applicable law or agreed to in writing, software
+*    distributed under the License is distributed on an "AS IS" BASIS,
+*    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*    See the License for the specific language governing permissions and
+*    limitations under the License.
+*/
+
+#ifndef _HYPERGRAPH_PARTITIONER_
+#define _HYPERGRAPH_PARTITIONER_
+
+#include "Partitioner.h"
+#include "CoordinateGraph.h"
+
+DEFINE_double(hypergraph_imbalance, 0.03, "For the hypergraph partitioner, how far (as a fraction) from an equal share of the datapoints the share of a thread may be.");
+DEFINE_int32(hypergraph_refinement_passes, 2, "For the hypergraph partitioner, most refinement passes per level.");
+DEFINE_int32(hypergraph_max_net_size, 1000, "For the hypergraph partitioner, coordinates touched by more datapoints are ignored when matching datapoints to coarsen (they are cut regardless).");
+DEFINE_bool(print_partition_cut, false, "For the hypergraph partitioner, should print the coordinates shared by threads that the partition cuts.");
+
+// Multilevel hypergraph partitioning of the datapoints across threads (in the
+// style of METIS / PaToH), minimizing the model rows shared by threads.
+//
+// Datapoints are the vertices, and every coordinate is a net connecting the
+// datapoints touching it. The cost of a partition is the connectivity - 1
+// metric: the sum over coordinates of the number of threads touching the
+// coordinate, minus one. Under hogwild that is the number of extra caches
+// each model row ping-pongs between.
+//
+// - Coarsening: vertices are matched in pairs, each to the unmatched neighbor
+//   it shares the most (small) nets with, and contracted, until the
+//   hypergraph is small or stops shrinking.
+// - Initial partition: parts are grown one at a time, breadth first over
+//   the nets, up to an equal share of the vertex weight.
+// - Uncoarsening: the partition is projected back level by level, and at
+//   every level rebalanced, filling the parts under FLAGS_hypergraph_imbalance
+//   of an equal share, then improved by greedy k-way refinement, moving
+//   vertices to the part that most reduces the cost while keeping every part
+//   within FLAGS_hypergraph_imbalance of an equal share (either way). At the
+//   finest level, where vertices weigh 1, every part ends up within it.
+class HypergraphPartitioner : public Partitioner {
+ private:
+    // Vertices, with weights, and nets as lists of pins (vertices), plus the
+    // transpose: the nets of each vertex.
+    struct Hypergraph {
+	std::vector<DatapointIndex> vertex_weights;
+	std::vector<DatapointIndex> net_starts, pins;
+	std::vector<DatapointIndex> vertex_starts;
+	std::vector<int> vertex_nets;
+
+	DatapointIndex NumVertices() const {
+	    return vertex_weights.size();
+	}
+
+	int NumNets() const {
+	    return net_starts.size()-1;
+	}
+
+	// Fill in vertex_starts and vertex_nets from the nets.
+	void BuildVertexNets() {
+	    DatapointIndex n_vertices = NumVertices();
+	    vertex_starts.assign(n_vertices+1, 0);
+	    for (auto const & pin : pins) {
+		vertex_starts[pin+1]++;
+	    }
+	    for (DatapointIndex v = 0; v < n_vertices; v++) {
+		vertex_starts[v+1] += vertex_starts[v];
+	    }
+	    std::vector<DatapointIndex> cursors(vertex_starts.begin(), vertex_starts.end()-1);
+	    vertex_nets.resize(pins.size());
+	    for (int net = 0; net < NumNets(); net++) {
+		for (DatapointIndex j = net_starts[net]; j < net_starts[net+1]; j++) {
+		    vertex_nets[cursors[pins[j]]++] = net;
+		}
+	    }
+	}
+    };
+
+    int n_parts;
+    DatapointIndex min_part_weight, max_part_weight;
+
+    // Nets of the datapoints: the coordinates touched by at least 2 of them.
+    void BuildFinest(const std::vector<Datapoint *> &datapoints, int n_threads, Hypergraph &graph) {
+	CoordinateGraph coordinate_graph(datapoints, n_threads);
+	graph.vertex_weights.assign(datapoints.size(), 1);
+	graph.net_starts.assign(1, 0);
+	for (int c = 0; c < coordinate_graph.NumCoordinates(); c++) {
+	    const DatapointIndex *datapoints_of = coordinate_graph.DatapointsOf(c);
+	    DatapointIndex start = graph.pins.size();
+	    for (DatapointIndex j = 0; j < coordinate_graph.NumDatapointsOf(c); j++) {
+		// Lists are sorted: skip a datapoint touching c more than once.
+		if (j == 0 || datapoints_of[j] != datapoints_of[j-1]) {
+		    graph.pins.push_back(datapoints_of[j]);
+		}
+	    }
+	    if (graph.pins.size() - start < 2) {
+		graph.pins.resize(start);
+		continue;
+	    }
+	    graph.net_starts.push_back(graph.pins.size());
+	}
+	graph.BuildVertexNets();
+    }
+
+    // Match and contract the vertices of fine into coarse, setting the coarse
+    // vertex of every fine vertex in map. Returns the number of coarse vertices.
+    DatapointIndex Coarsen(const Hypergraph &fine, DatapointIndex max_vertex_weight,
+			   Hypergraph &coarse, std::vector<DatapointIndex> &map) {
+	DatapointIndex n_vertices = fine.NumVertices();
+	std::vector<DatapointIndex> order(n_vertices);
+	for (DatapointIndex v = 0; v < n_vertices; v++) {
+	    order[v] = v;
+	}
+	std::random_shuffle(order.begin(), order.end());
+
+	map.assign(n_vertices, -1);
+	std::vector<double> scores(n_vertices, 0);
+	std::vector<DatapointIndex> scored;
+	DatapointIndex n_coarse = 0;
+	for (auto const & v : order) {
+	    if (map[v] >= 0) continue;
+	    for (DatapointIndex j = fine.vertex_starts[v]; j < fine.vertex_starts[v+1]; j++) {
+		int net = fine.vertex_nets[j];
+		DatapointIndex size = fine.net_starts[net+1] - fine.net_starts[net];
+		if (size > FLAGS_hypergraph_max_net_size) continue;
+		for (DatapointIndex k = fine.net_starts[net]; k < fine.net_starts[net+1]; k++) {
+		    DatapointIndex u = fine.pins[k];
+		    if (u == v || map[u] >= 0 ||
+			fine.vertex_weights[u] + fine.vertex_weights[v] > max_vertex_weight) continue;
+		    if (scores[u] == 0) scored.push_back(u);
+		    scores[u] += 1.0 / (size-1);
+		}
+	    }
+	    DatapointIndex best = -1;
+	    for (auto const & u : scored) {
+		if (best < 0 || scores[u] > scores[best]) best = u;
+		scores[u] = 0;
+	    }
+	    scored.clear();
+	    map[v] = n_coarse;
+	    if (best >= 0) map[best] = n_coarse;
+	    n_coarse++;
+	}
+
+	coarse.vertex_weights.assign(n_coarse, 0);
+	for (DatapointIndex v = 0; v < n_vertices; v++) {
+	    coarse.vertex_weights[map[v]] += fine.vertex_weights[v];
+	}
+	coarse.net_starts.assign(1, 0);
+	coarse.pins.clear();
+	for (int net = 0; net < fine.NumNets(); net++) {
+	    DatapointIndex start = coarse.pins.size();
+	    for (DatapointIndex k = fine.net_starts[net]; k < fine.net_starts[net+1]; k++) {
+		coarse.pins.push_back(map[fine.pins[k]]);
+	    }
+	    std::sort(coarse.pins.begin() + start, coarse.pins.end());
+	    coarse.pins.erase(std::unique(coarse.pins.begin() + start, coarse.pins.end()), coarse.pins.end());
+	    if (coarse.pins.size() - start < 2) {
+		coarse.pins.resize(start);
+		continue;
+	    }
+	    coarse.net_starts.push_back(coarse.pins.size());
+	}
+	coarse.BuildVertexNets();
+	return n_coarse;
+    }
+
+    // Grow the parts one at a time, breadth first over the nets.
+    void InitialPartition(const Hypergraph &graph, std::vector<int> &parts) {
+	DatapointIndex n_vertices = graph.NumVertices();
+	DatapointIndex total_weight = 0;
+	for (auto const & weight : graph.vertex_weights) {
+	    total_weight += weight;
+	}
+	parts.assign(n_vertices, -1);
+	std::vector<char> net_visited(graph.NumNets(), 0);
+	std::vector<DatapointIndex> queue;
+	DatapointIndex next_seed = 0, assigned_weight = 0;
+	for (int part = 0; part < n_parts; part++) {
+	    DatapointIndex target = (long long)total_weight * (part+1) / n_parts - assigned_weight;
+	    DatapointIndex part_weight = 0;
+	    queue.clear();
+	    size_t head = 0;
+	    while (part_weight < target || part == n_parts-1) {
+		if (head == queue.size()) {
+		    while (next_seed < n_vertices && parts[next_seed] >= 0) next_seed++;
+		    if (next_seed == n_vertices) break;
+		    parts[next_seed] = part;
+		    queue.push_back(next_seed);
+		}
+		DatapointIndex v = queue[head++];
+		part_weight += graph.vertex_weights[v];
+		for (DatapointIndex j = graph.vertex_starts[v]; j < graph.vertex_starts[v+1]; j++) {
+		    int net = graph.vertex_nets[j];
+		    if (net_visited[net]) continue;
+		    net_visited[net] = 1;
+		    for (DatapointIndex k = graph.net_starts[net]; k < graph.net_starts[net+1]; k++) {
+			if (parts[graph.pins[k]] < 0) {
+			    parts[graph.pins[k]] = part;
+			    queue.push_back(graph.pins[k]);
+			}
+		    }
+		}
+		// Vertices queued beyond the target are returned.
+		if (part_weight >= target && part != n_parts-1) {
+		    for (size_t i = head; i < queue.size(); i++) {
+			parts[queue[i]] = -1;
+		    }
+		    queue.resize(head);
+		}
+	    }
+	    assigned_weight += part_weight;
+	}
+    }
+
+    // Move vertex v to part to, updating the pin counts (of every net, per
+    // part) and the part weights.
+    void Move(const Hypergraph &graph, DatapointIndex v, int to, std::vector<int> &parts,
+	      std::vector<DatapointIndex> &pin_counts, std::vector<DatapointIndex> &part_weights) {
+	int from = parts[v];
+	for (DatapointIndex j = graph.vertex_starts[v]; j < graph.vertex_starts[v+1]; j++) {
+	    DatapointIndex *counts = &pin_counts[(size_t)graph.vertex_nets[j] * n_parts];
+	    counts[from]--;
+	    counts[to]++;
+	}
+	part_weights[from] -= graph.vertex_weights[v];
+	part_weights[to] += graph.vertex_weights[v];
+	parts[v] = to;
+    }
+
+    // Fill every part under min_part_weight, moving to it the vertices with
+    // the best gain (computed once, before moving any) from the parts that
+    // can spare them.
+    void Rebalance(const Hypergraph &graph, std::vector<int> &parts,
+		   std::vector<DatapointIndex> &pin_counts, std::vector<DatapointIndex> &part_weights) {
+	DatapointIndex n_vertices = graph.NumVertices();
+	for (int part = 0; part < n_parts; part++) {
+	    if (part_weights[part] >= min_part_weight) continue;
+	    // (-gain, vertex), to move the best gains first.
+	    std::vector<std::pair<DatapointIndex, DatapointIndex> > candidates;
+	    for (DatapointIndex v = 0; v < n_vertices; v++) {
+		int from = parts[v];
+		if (from == part) continue;
+		DatapointIndex gain = 0;
+		for (DatapointIndex j = graph.vertex_starts[v]; j < graph.vertex_starts[v+1]; j++) {
+		    const DatapointIndex *counts = &pin_counts[(size_t)graph.vertex_nets[j] * n_parts];
+		    if (counts[from] == 1) gain++;
+		    if (counts[part] == 0) gain--;
+		}
+		candidates.push_back(std::make_pair(-gain, v));
+	    }
+	    std::sort(candidates.begin(), candidates.end());
+	    for (auto const & candidate : candidates) {
+		if (part_weights[part] >= min_part_weight) break;
+		DatapointIndex v = candidate.second;
+		DatapointIndex weight = graph.vertex_weights[v];
+		if (part_weights[parts[v]] - weight < min_part_weight ||
+		    part_weights[part] + weight > max_part_weight) continue;
+		Move(graph, v, part, parts, pin_counts, part_weights);
+	    }
+	}
+    }
+
+    // Greedy k-way refinement, after rebalancing. A vertex moves to the part
+    // with the best gain (the decrease in connectivity - 1) if it is positive,
+    // or, if its part is overweight, to the feasible part with the best gain.
+    void Refine(const Hypergraph &graph, std::vector<int> &parts) {
+	DatapointIndex n_vertices = graph.NumVertices();
+	std::vector<DatapointIndex> pin_counts((size_t)graph.NumNets() * n_parts, 0);
+	std::vector<DatapointIndex> part_weights(n_parts, 0);
+	for (DatapointIndex v = 0; v < n_vertices; v++) {
+	    part_weights[parts[v]] += graph.vertex_weights[v];
+	    for (DatapointIndex j = graph.vertex_starts[v]; j < graph.vertex_starts[v+1]; j++) {
+		pin_counts[(size_t)graph.vertex_nets[j] * n_parts + parts[v]]++;
+	    }
+	}
+	Rebalance(graph, parts, pin_counts, part_weights);
+
+	// present[p]: number of nets of the vertex with pins in part p.
+	std::vector<DatapointIndex> present(n_parts);
+	for (int pass = 0; pass < FLAGS_hypergraph_refinement_passes; pass++) {
+	    DatapointIndex n_moves = 0;
+	    for (DatapointIndex v = 0; v < n_vertices; v++) {
+		int from = parts[v];
+		DatapointIndex weight = graph.vertex_weights[v];
+		DatapointIndex degree = graph.vertex_starts[v+1] - graph.vertex_starts[v];
+		std::fill(present.begin(), present.end(), 0);
+		DatapointIndex leaving = 0;
+		for (DatapointIndex j = graph.vertex_starts[v]; j < graph.vertex_starts[v+1]; j++) {
+		    const DatapointIndex *counts = &pin_counts[(size_t)graph.vertex_nets[j] * n_parts];
+		    if (counts[from] == 1) leaving++;
+		    for (int part = 0; part < n_parts; part++) {
+			if (counts[part] > 0) present[part]++;
+		    }
+		}
+		bool overweight = part_weights[from] > max_part_weight;
+		if (!overweight && part_weights[from] - weight < min_part_weight) continue;
+		int best = -1;
+		DatapointIndex best_gain = 0;
+		for (int part = 0; part < n_parts; part++) {
+		    if (part == from || part_weights[part] + weight > max_part_weight) continue;
+		    // Nets leaving from, minus nets newly reaching part.
+		    DatapointIndex gain = leaving - (degree - present[part]);
+		    if (gain > best_gain || (overweight && (best < 0 || gain > best_gain))) {
+			best = part;
+			best_gain = gain;
+		    }
+		}
+		if (best < 0) continue;
+		Move(graph, v, best, parts, pin_counts, part_weights);
+		n_moves++;
+	    }
+	    if (n_moves == 0) break;
+	}
+    }
+
+ public:
+    HypergraphPartitioner() {}
+    ~HypergraphPartitioner() {}
+
+    DatapointPartitions Partition(const std::vector<Datapoint *> &datapoints, int n_threads) {
+	DatapointIndex n_datapoints = datapoints.size();
+	n_parts = n_threads;
+	min_part_weight = (1 - FLAGS_hypergraph_imbalance) * n_datapoints / n_parts;
+	max_part_weight = (1 + FLAGS_hypergraph_imbalance) * n_datapoints / n_parts + 1;
+
+	// Coarsen.
+	std::vector<Hypergraph> levels(1);
+	std::vector<std::vector<DatapointIndex> > maps;
+	BuildFinest(datapoints, n_threads, levels[0]);
+	DatapointIndex coarsest_size = 64 * n_parts;
+	DatapointIndex max_vertex_weight = std::max((DatapointIndex)1, n_datapoints / coarsest_size);
+	while (n_parts > 1 && levels.back().NumVertices() > coarsest_size) {
+	    Hypergraph coarse;
+	    std::vector<DatapointIndex> map;
+	    DatapointIndex n_coarse = Coarsen(levels.back(), max_vertex_weight, coarse, map);
+	    if (n_coarse > 0.9 * levels.back().NumVertices()) break;
+	    levels.push_back(Hypergraph());
+	    std::swap(levels.back(), coarse);
+	    maps.push_back(std::move(map));
+	}
+
+	// Partition the coarsest level, then project and refine.
+	std::vector<int> parts;
+	InitialPartition(levels.back(), parts);
+	Refine(levels.back(), parts);
+	for (int level = levels.size()-2; level >= 0; level--) {
+	    const std::vector<DatapointIndex> &map = maps[level];
+	    std::vector<int> fine_parts(map.size());
+	    for (DatapointIndex v = 0; v < map.size(); v++) {
+		fine_parts[v] = parts[map[v]];
+	    }
+	    parts.swap(fine_parts);
+	    levels.pop_back();
+	    Refine(levels.back(), parts);
+	}
+
+	if (FLAGS_print_partition_cut) {
+	    PrintCut(levels[0], parts);
+	}
+
+	DatapointPartitions partitions(datapoints, n_threads);
+	for (DatapointIndex i = 0; i < n_datapoints; i++) {
+	    partitions.AddDatapointToThread(datapoints[i], parts[i]);
+	}
+	return partitions;
+    }
+
+    // Report the coordinates touched by more than one thread and the
+    // connectivity - 1 of the partition.
+    void PrintCut(const Hypergraph &graph, const std::vector<int> &parts) {
+	long long n_cut = 0, connectivity = 0;
+	std::vector<int> last_seen(n_parts, -1);
+	for (int net = 0; net < graph.NumNets(); net++) {
+	    int n_touching = 0;
+	    for (DatapointIndex k = graph.net_starts[net]; k < graph.net_starts[net+1]; k++) {
+		int part = parts[graph.pins[k]];
+		if (last_seen[part] != net) {
+		    last_seen[part] = net;
+		    n_touching++;
+		}
+	    }
+	    if (n_touching > 1) n_cut++;
+	    connectivity += n_touching - 1;
+	}
+	std::cout << "Hypergraph partition: " << n_cut << " of " << graph.NumNets()
+		  << " shared coordinates cut, connectivity-1 " << connectivity << std::endl;
+    }
+};
+
+#endif
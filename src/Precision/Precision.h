@@ -0,0 +1,160 @@
+/*
+* Copyright 2016 [See AUTHORS file for list of authors]
+*
+*    Licensed under the Apache License, Version 2.0 (the "License");
+*    you may not use this file except in compliance with the License.
+*    You may obtain a copy of the License at
+*
+*        http://www.apache.org/licenses/LICENSE-2.0
+*
+*    Unless required by applicable law or agreed to in writing, software
+*    distributed under the License is distributed on an "AS IS" BASIS,
+*    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*    See the License for the specific language governing permissions and
+*    limitations under the License.
+*/
+
+#ifndef _PRECISION_
+#define _PRECISION_
+
+#include <stdint.h>
+#include <string.h>
+#include <omp.h>
+#include <vector>
+#include "../Allocator/HugePageAllocator.h"
+#include "../Model/Model.h"
+
+DEFINE_string(model_precision, "double", "Precision the fast matrix completion / word embeddings updaters keep the model in while training: double, float or bf16 (bfloat16 storage, float arithmetic).");
+
+// bfloat16: the upper 16 bits of an IEEE single. Only a storage format;
+// converts to float for arithmetic, rounding to nearest even on the way back.
+struct bfloat16 {
+    uint16_t bits;
+
+    bfloat16() : bits(0) {}
+
+    bfloat16(float value) {
+	uint32_t word;
+	memcpy(&word, &value, sizeof(word));
+	if ((word & 0x7fffffff) > 0x7f800000) {
+	    // Keep NaNs NaN.
+	    bits = (word >> 16) | 0x40;
+	}
+	else {
+	    bits = (word + 0x7fff + ((word >> 16) & 1)) >> 16;
+	}
+    }
+
+    operator float() const {
+	uint32_t word = (uint32_t)bits << 16;
+	float value;
+	memcpy(&value, &word, sizeof(value));
+	return value;
+    }
+};
+
+// *value += delta, atomically, for model values several threads update at
+// once (e.g: cyclades hub coordinates, see Updater::SetHubCoordinates).
+inline void AtomicAdd(double *value, double delta) {
+#pragma omp atomic
+    *value += delta;
+}
+
+inline void AtomicAdd(float *value, float delta) {
+#pragma omp atomic
+    *value += delta;
+}
+
+inline void AtomicAdd(bfloat16 *value, float delta) {
+    uint16_t expected = value->bits;
+    while (true) {
+	bfloat16 old_value;
+	old_value.bits = expected;
+	uint16_t desired = bfloat16((float)old_value + delta).bits;
+	uint16_t seen = __sync_val_compare_and_swap(&value->bits, expected, desired);
+	if (seen == expected) break;
+	expected = seen;
+    }
+}
+
+// Type to do arithmetic in for values stored as Storage.
+template <class Storage>
+struct ComputeType {
+    typedef Storage type;
+};
+
+template <>
+struct ComputeType<bfloat16> {
+    typedef float type;
+};
+
+// A copy of the model data in Storage precision, for updaters that train on
+// a reduced precision model. Acquire it before an epoch's updates: the
+// first time it is loaded from the model, which is then released while the
+// copy is trained on, so that only the copy stays resident. Sync it back
+// (in double) before the model is read, e.g: for loss computation or after
+// training. The copy stays the model trained on, so bf16 values aren't
+// rounded again on every load.
+// Only the row_size values of each row are copied, into rows padded to
+// cache lines in Storage (see Model::AlignedRowStride), not the model's
+// stride: padding or row stamps of the model come back zeroed.
+template <class Storage>
+class ReducedPrecisionModel {
+ private:
+    // Allocated like the model it mirrors (see HugePages).
+    std::vector<Storage, HugePageAllocator<Storage> > data;
+    int row_stride;
+    // Size of the model data, 0 until loaded.
+    size_t model_size;
+
+    void Load(ModelVector &model_data, int model_row_stride, int row_size, int n_threads) {
+	long long n_rows = model_data.size() / model_row_stride;
+	row_stride = Model::AlignedRowStride(row_size, sizeof(Storage));
+	data.resize(n_rows * row_stride);
+#pragma omp parallel for num_threads(n_threads)
+	for (long long row = 0; row < n_rows; row++) {
+	    for (int i = 0; i < row_size; i++) {
+		data[row * row_stride + i] = (Storage)model_data[row * model_row_stride + i];
+	    }
+	}
+    }
+
+    void Store(ModelVector &model_data, int model_row_stride, int row_size, int n_threads) {
+	long long n_rows = model_data.size() / model_row_stride;
+#pragma omp parallel for num_threads(n_threads)
+	for (long long row = 0; row < n_rows; row++) {
+	    for (int i = 0; i < row_size; i++) {
+		model_data[row * model_row_stride + i] = (typename ComputeType<Storage>::type)data[row * row_stride + i];
+	    }
+	}
+    }
+
+ public:
+    ReducedPrecisionModel() : row_stride(0), model_size(0) {}
+    ~ReducedPrecisionModel() {}
+
+    void Acquire(ModelVector &model_data, int model_row_stride, int row_size, int n_threads) {
+	if (model_size == 0) {
+	    Load(model_data, model_row_stride, row_size, n_threads);
+	    model_size = model_data.size();
+	}
+	ModelVector().swap(model_data);
+    }
+
+    void Sync(ModelVector &model_data, int model_row_stride, int row_size, int n_threads) {
+	if (model_size == 0 || !model_data.empty()) return;
+	model_data.assign(model_size, 0);
+	Store(model_data, model_row_stride, row_size, n_threads);
+    }
+
+    Storage *Data() {
+	return data.data();
+    }
+
+    // Stride, in Storage values, of the rows of Data().
+    int RowStride() {
+	return row_stride;
+    }
+};
+
+#endif
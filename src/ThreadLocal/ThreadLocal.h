@@ -0,0 +1,98 @@
+/*
+* Copyright 2016 [See AUTHORS file for list of authors]
+*
+*    Licensed under the Apache License, Version 2.0 (the "License");
+*    you may not use this file except in compliance with the License.
+*    You may obtain a copy of the License at
+*
+*        http://www.apache.org/licenses/LICENSE-2.0
+*
+*    Unless required by applicable law or agreed to in writing, software
+*    distributed under the License is distributed on an "AS IS" BASIS,
+*    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*    See the License for the specific language governing permissions and
+*    limitations under the License.
+*/
+
+#ifndef _THREAD_LOCAL_
+#define _THREAD_LOCAL_
+
+#include <omp.h>
+#include <stdlib.h>
+#include <iostream>
+#include <new>
+#include <vector>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+// Typed per-thread storage.
+//
+// Every thread gets its own slot holding a T. Each slot is a separate
+// cache line aligned allocation, padded to a whole number of cache lines,
+// so that writes by one thread never invalidate lines of another thread's slot.
+// Slots are allocated and constructed by the thread that owns them, so with
+// first-touch page placement a slot (and any memory its constructor fills in,
+// e.g: the buffer of a std::vector) lives on the owning thread's NUMA node.
+//
+// Look the slot up once per unit of work (e.g: an update) via Get(thread),
+// and hold on to the reference, rather than resolving it per element access.
+template <class T>
+class ThreadLocal {
+ private:
+    std::vector<T *> slots;
+
+    static size_t PaddedSize() {
+	return (sizeof(T) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    }
+
+    void Free() {
+	for (int i = 0; i < slots.size(); i++) {
+	    if (slots[i] != NULL) {
+		slots[i]->~T();
+		free(slots[i]);
+	    }
+	}
+	slots.clear();
+    }
+
+ public:
+    ThreadLocal() {}
+    ThreadLocal(const ThreadLocal &other) = delete;
+    ThreadLocal &operator=(const ThreadLocal &other) = delete;
+    ~ThreadLocal() {
+	Free();
+    }
+
+    // Allocate one slot per thread, each constructed as T(args...) by its owner.
+    template <class... Args>
+    void Initialize(int n_threads, const Args &... args) {
+	Free();
+	slots.resize(n_threads, NULL);
+#pragma omp parallel for num_threads(n_threads) schedule(static, 1)
+	for (int thread = 0; thread < n_threads; thread++) {
+	    void *memory = NULL;
+	    if (posix_memalign(&memory, CACHE_LINE_SIZE, PaddedSize()) != 0) {
+		std::cerr << "ThreadLocal: Could not allocate thread local slot." << std::endl;
+		exit(0);
+	    }
+	    slots[thread] = new (memory) T(args...);
+	}
+    }
+
+    int NumThreads() const {
+	return slots.size();
+    }
+
+    inline T & Get(int thread) {
+	return *slots[thread];
+    }
+
+    // Convenience accessor for code outside the update path.
+    inline T & Local() {
+	return *slots[omp_get_thread_num()];
+    }
+};
+
+#endif
@@ -22,18 +22,18 @@
 #include "../Partitioner/GreedyCachePartitioner.h"
 
 DEFINE_bool(dfs_cache_partitioner, false, "For cache efficient hogwild trainer, use the DFS method to cache partition data points.");
-DEFINE_bool(greedy_cache_partitioner, false, "For cache efficient hogwild trainer, use an n^2 greedy algorithm to generate cache friendyl data point ordering.");
+DEFINE_bool(greedy_cache_partitioner, false, "For cache efficient hogwild trainer, use a greedy algorithm to generate cache friendly data point ordering (see GreedyCachePartitioner).");
 
 class CacheEfficientHogwildTrainer : public Trainer {
 protected:
     void PrintStatsAboutProblem(const std::vector<Datapoint *> &datapoints) {
-	int n_total_coordinate_accesses = 0;
+	long long n_total_coordinate_accesses = 0;
 	int n_distinct_model_accesses = 0;
 	double avg_num_coordinates_accessed_per_datapoint = 0;
 	int max_coordinates_accessed_per_datapoint = 0;
 	int min_coordinates_accessed_per_datapoint = INT_MAX;
 	std::map<int, bool> coordinates_set;
-	for (int i = 0; i < datapoints.size(); i++) {
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
 	    n_total_coordinate_accesses += datapoints[i]->GetCoordinates().size();
 	    for (const auto & coordinate : datapoints[i]->GetCoordinates()) {
 		coordinates_set[coordinate] = 1;
@@ -43,13 +43,13 @@ protected:
 	}
 	n_distinct_model_accesses = coordinates_set.size();
 	avg_num_coordinates_accessed_per_datapoint = n_total_coordinate_accesses / (double)datapoints.size();
-	printf("n_datapoints=%d\n"
-	       "n_total_coordinate_accesses=%d\n"
+	printf("n_datapoints=%lld\n"
+	       "n_total_coordinate_accesses=%lld\n"
 	       "n_distinct_model_acceses=%d\n"
 	       "avg_num_coordinates_accessed_per_datapoint=%lf\n"
 	       "max_coordinates_accessed=%d\n"
 	       "min_coordinates_accessed=%d\n",
-	       (int)datapoints.size(),
+	       (long long)datapoints.size(),
 	       n_total_coordinate_accesses,
 	       n_distinct_model_accesses,
 	       avg_num_coordinates_accessed_per_datapoint,
@@ -66,7 +66,7 @@ public:
 
 	// Partition.
 	Timer partition_timer;
-	DatapointPartitions partitions(FLAGS_n_threads);
+	DatapointPartitions partitions(datapoints, FLAGS_n_threads);
 	if (FLAGS_dfs_cache_partitioner) {
 	    DFSCachePartitioner partitioner;
 	    partitions = partitioner.Partition(datapoints, FLAGS_n_threads);
@@ -83,6 +83,7 @@ public:
 	    this->PrintPartitionTime(partition_timer);
 	}
 
+	this->PlaceData(model, partitions);
 	model->SetUpWithPartitions(partitions);
 	updater->SetUpWithPartitions(partitions);
 
@@ -91,19 +92,22 @@ public:
 	// Train.
 	Timer gradient_timer;
 	for (int epoch = 0; epoch < FLAGS_n_epochs; epoch++) {
-	    this->EpochBegin(epoch, gradient_timer, model, datapoints, &stats);
+	    this->EpochBegin(epoch, gradient_timer, model, updater, datapoints, &stats);
 
 	    updater->EpochBegin();
 
 #pragma omp parallel for schedule(static, 1)
 	    for (int thread = 0; thread < FLAGS_n_threads; thread++) {
 		for (int batch = 0; batch < partitions.NumBatches(); batch++) {
-		    for (int index = 0; index < partitions.NumDatapointsInBatch(thread, batch); index++) {
+		    DatapointIndex n_datapoints = partitions.NumDatapointsInBatch(thread, batch);
+		    auto datapoint_at = [&](DatapointIndex i) { return partitions.GetDatapoint(thread, batch, i); };
+		    for (DatapointIndex index = 0; index < n_datapoints; index++) {
+			this->PrefetchAhead(updater, index, n_datapoints, datapoint_at);
 			updater->Update(model, partitions.GetDatapoint(thread, batch, index));
 		    }
 		}
 	    }
-	    updater->EpochFinish();
+	    this->EpochFinish(epoch, updater, &stats);
 	}
 	return stats;
     }
@@ -16,6 +16,8 @@
 #ifndef _CYCLADES_TRAINER_
 #define _CYCLADES_TRAINER_
 
+DEFINE_int32(cyclades_gather_component_size, 0, "Run the updates of cyclades components with at least this many datapoints against a contiguous thread local copy of the model rows they touch (see Updater::UpdateGathered). 0 disables it.");
+
 class CycladesTrainer : public Trainer {
 private:
 
@@ -24,7 +26,7 @@ private:
 	    std::cout << "Batch " << i << std::endl;
 	    for (int j = 0; j < FLAGS_n_threads; j++) {
 		std::cout << "Thread " << j << ": ";
-		for (int k = 0; k < p.NumDatapointsInBatch(j, i); k++) {
+		for (DatapointIndex k = 0; k < p.NumDatapointsInBatch(j, i); k++) {
 		    if (k != 0) std::cout << " ";
 		    std::cout << p.GetDatapoint(j, i, k)->GetOrder();
 		}
@@ -40,6 +42,67 @@ public:
     ~CycladesTrainer() {
     }
 
+    // Run a thread's batch component by component. Components with at least
+    // FLAGS_cyclades_gather_component_size datapoints are gathered if
+    // gather is set (see Updater::UpdateGathered). The others are run up to
+    // width at a time: components share no coordinates, so every round hands
+    // the updater the next datapoint of each component in flight (see
+    // Updater::UpdateIndependent), with the same result as running them in turn.
+    void RunComponents(Model *model, Updater *updater, DatapointPartitions &partitions,
+		       int thread, int batch, bool gather, int width) {
+	DatapointIndex n_datapoints = partitions.NumDatapointsInBatch(thread, batch);
+	int n_components = partitions.NumComponentsInBatch(thread, batch);
+	auto datapoint_at = [&](DatapointIndex i) { return partitions.GetDatapoint(thread, batch, i); };
+	std::vector<DatapointIndex> cursors(width), ends(width);
+	std::vector<Datapoint *> group(width), component;
+	int n_lanes = 0, next_component = 0;
+	while (true) {
+	    // Start the next components in the free lanes.
+	    while (n_lanes < width && next_component < n_components) {
+		DatapointIndex start = partitions.ComponentStart(thread, batch, next_component);
+		DatapointIndex size = partitions.ComponentSize(thread, batch, next_component);
+		next_component++;
+		if (gather && size >= FLAGS_cyclades_gather_component_size) {
+		    component.resize(size);
+		    for (DatapointIndex i = 0; i < size; i++) {
+			component[i] = datapoint_at(start + i);
+		    }
+		    updater->UpdateGathered(model, component.data(), size);
+		    continue;
+		}
+		if (size == 0) continue;
+		cursors[n_lanes] = start;
+		ends[n_lanes] = start + size;
+		n_lanes++;
+	    }
+	    if (n_lanes == 0) break;
+
+	    if (width == 1) {
+		// Gathered components run on a copy of their rows, so don't
+		// prefetch past the end of the component.
+		this->PrefetchAhead(updater, cursors[0], gather ? ends[0] : n_datapoints, datapoint_at);
+		updater->Update(model, datapoint_at(cursors[0]));
+	    }
+	    else {
+		for (int lane = 0; lane < n_lanes; lane++) {
+		    group[lane] = datapoint_at(cursors[lane]);
+		}
+		updater->UpdateIndependent(model, group.data(), n_lanes);
+	    }
+
+	    // Advance, dropping the components that are done.
+	    int n_remaining = 0;
+	    for (int lane = 0; lane < n_lanes; lane++) {
+		if (++cursors[lane] < ends[lane]) {
+		    cursors[n_remaining] = cursors[lane];
+		    ends[n_remaining] = ends[lane];
+		    n_remaining++;
+		}
+	    }
+	    n_lanes = n_remaining;
+	}
+    }
+
     TrainStatistics Train(Model *model, const std::vector<Datapoint *> & datapoints, Updater *updater) override {
 	// Partitions.
 	CycladesPartitioner partitioner(model);
@@ -49,8 +112,11 @@ public:
 	    this->PrintPartitionTime(partition_timer);
 	}
 
+	this->PlaceData(model, partitions);
 	model->SetUpWithPartitions(partitions);
 	updater->SetUpWithPartitions(partitions);
+	updater->SetHubCoordinates(partitioner.HubCoordinates());
+	bool has_hubs = !partitioner.HubCoordinates().empty();
 
 	// Default batch ordering.
 	std::vector<int> batch_ordering(partitions.NumBatches());
@@ -58,19 +124,25 @@ public:
 	    batch_ordering[i] = i;
 	}
 
-	// Default datapoint processing ordering.
-	// [thread][batch][index].
-	std::vector<std::vector<std::vector<int> > > per_batch_datapoint_order(FLAGS_n_threads);
-	for (int thread = 0; thread < FLAGS_n_threads; thread++) {
-	    per_batch_datapoint_order[thread].resize(partitions.NumBatches());
-	    for (int batch = 0; batch < partitions.NumBatches(); batch++) {
-		per_batch_datapoint_order[thread][batch].resize(partitions.NumDatapointsInBatch(thread, batch));
-		for (int index = 0; index < partitions.NumDatapointsInBatch(thread, batch); index++) {
-		    per_batch_datapoint_order[thread][batch][index] = index;
-		}
+	// Random per batch datapoint processing ordering, of each batch of a
+	// thread, laid out like the thread's datapoints (in partition order otherwise).
+	// [thread][batch start + index].
+	std::vector<std::vector<DatapointIndex> > datapoint_order(FLAGS_n_threads);
+	if (FLAGS_random_per_batch_datapoint_processing) {
+	    for (int thread = 0; thread < FLAGS_n_threads; thread++) {
+		datapoint_order[thread].resize(partitions.NumDatapointsOfThread(thread));
 	    }
 	}
 
+	// Components are only kept together when processed in partition order.
+	// With hubs, components are no longer disjoint: gathered rows or
+	// datapoints run together may share a hub.
+	bool gather_components = FLAGS_cyclades_gather_component_size > 0 &&
+	    !FLAGS_random_per_batch_datapoint_processing && !has_hubs &&
+	    updater->CanGatherUpdates();
+	int independent_batch_width = FLAGS_random_per_batch_datapoint_processing || has_hubs ? 1 : updater->IndependentBatchWidth();
+	bool run_components = gather_components || independent_batch_width > 1;
+
 	// Keep track of statistics of training.
 	TrainStatistics stats;
 
@@ -78,7 +150,7 @@ public:
 	Timer gradient_timer;
 	for (int epoch = 0; epoch < FLAGS_n_epochs; epoch++) {
 
-	    this->EpochBegin(epoch, gradient_timer, model, datapoints, &stats);
+	    this->EpochBegin(epoch, gradient_timer, model, updater, datapoints, &stats);
 
 	    // Random batch ordering generation.
 	    if (FLAGS_random_batch_processing) {
@@ -91,8 +163,9 @@ public:
 	    if (FLAGS_random_per_batch_datapoint_processing) {
 		for (int thread = 0; thread < FLAGS_n_threads; thread++) {
 		    for (int batch = 0; batch < partitions.NumBatches(); batch++) {
-			for (int index = 0; index < partitions.NumDatapointsInBatch(thread, batch); index++) {
-			    per_batch_datapoint_order[thread][batch][index] = rand() % partitions.NumDatapointsInBatch(thread, batch);
+			DatapointIndex batch_start = partitions.BatchStart(thread, batch);
+			for (DatapointIndex index = 0; index < partitions.NumDatapointsInBatch(thread, batch); index++) {
+			    datapoint_order[thread][batch_start + index] = rand() % partitions.NumDatapointsInBatch(thread, batch);
 			}
 		    }
 		}
@@ -106,14 +179,23 @@ public:
 		for (int batch_count = 0; batch_count < partitions.NumBatches(); batch_count++) {
 		    int batch = batch_ordering[batch_count];
 #pragma omp barrier
-		    for (int index_count = 0; index_count < partitions.NumDatapointsInBatch(thread, batch); index_count++) {
-			int index = per_batch_datapoint_order[thread][batch][index_count];
+		    if (run_components) {
+			RunComponents(model, updater, partitions, thread, batch, gather_components, independent_batch_width);
+			continue;
+		    }
+		    DatapointIndex n_datapoints = partitions.NumDatapointsInBatch(thread, batch);
+		    const DatapointIndex *order = FLAGS_random_per_batch_datapoint_processing ?
+			datapoint_order[thread].data() + partitions.BatchStart(thread, batch) : NULL;
+		    auto datapoint_at = [&](DatapointIndex i) { return partitions.GetDatapoint(thread, batch, order ? order[i] : i); };
+		    for (DatapointIndex index_count = 0; index_count < n_datapoints; index_count++) {
+			this->PrefetchAhead(updater, index_count, n_datapoints, datapoint_at);
+			DatapointIndex index = order ? order[index_count] : index_count;
 			updater->Update(model, partitions.GetDatapoint(thread, batch, index));
 		    }
 		}
 	    }
 
-	    updater->EpochFinish();
+	    this->EpochFinish(epoch, updater, &stats);
 	}
 	return stats;
     }
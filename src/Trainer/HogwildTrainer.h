@@ -16,6 +16,10 @@
 #ifndef _HOGWILD_TRAINER_
 #define _HOGWILD_TRAINER_
 
+#include "../Partitioner/HypergraphPartitioner.h"
+
+DEFINE_bool(hypergraph_partitioner, false, "For hogwild trainer, assign datapoints to threads with the multilevel hypergraph partitioner, minimizing the model rows shared by threads (rather than splitting them by position).");
+
 class HogwildTrainer : public Trainer {
 public:
     HogwildTrainer() {}
@@ -23,26 +27,30 @@ public:
 
     TrainStatistics Train(Model *model, const std::vector<Datapoint *> & datapoints, Updater *updater) override {
 	// Partition.
-	BasicPartitioner partitioner;
 	Timer partition_timer;
-	DatapointPartitions partitions = partitioner.Partition(datapoints, FLAGS_n_threads);
+	DatapointPartitions partitions(datapoints, FLAGS_n_threads);
+	if (FLAGS_hypergraph_partitioner) {
+	    HypergraphPartitioner partitioner;
+	    partitions = partitioner.Partition(datapoints, FLAGS_n_threads);
+	}
+	else {
+	    BasicPartitioner partitioner;
+	    partitions = partitioner.Partition(datapoints, FLAGS_n_threads);
+	}
 	if (FLAGS_print_partition_time) {
 	    this->PrintPartitionTime(partition_timer);
 	}
 
+	this->PlaceData(model, partitions);
 	model->SetUpWithPartitions(partitions);
 	updater->SetUpWithPartitions(partitions);
 
-	// Default datapoint processing ordering.
-	// [thread][batch][index].
-	std::vector<std::vector<std::vector<int> > > per_batch_datapoint_order(FLAGS_n_threads);
-	for (int thread = 0; thread < FLAGS_n_threads; thread++) {
-	    per_batch_datapoint_order[thread].resize(partitions.NumBatches());
-	    for (int batch = 0; batch < partitions.NumBatches(); batch++) {
-		per_batch_datapoint_order[thread][batch].resize(partitions.NumDatapointsInBatch(thread, batch));
-		for (int index = 0; index < partitions.NumDatapointsInBatch(thread, batch); index++) {
-		    per_batch_datapoint_order[thread][batch][index] = index;
-		}
+	// Random datapoint processing ordering (in partition order otherwise).
+	// [thread][index].
+	std::vector<std::vector<DatapointIndex> > datapoint_order(FLAGS_n_threads);
+	if (FLAGS_random_per_batch_datapoint_processing) {
+	    for (int thread = 0; thread < FLAGS_n_threads; thread++) {
+		datapoint_order[thread].resize(partitions.NumDatapointsOfThread(thread));
 	    }
 	}
 
@@ -53,14 +61,14 @@ public:
 	Timer gradient_timer;
 	for (int epoch = 0; epoch < FLAGS_n_epochs; epoch++) {
 
-	    this->EpochBegin(epoch, gradient_timer, model, datapoints, &stats);
+	    this->EpochBegin(epoch, gradient_timer, model, updater, datapoints, &stats);
 
 	    // Random per batch datapoint processing.
 	    if (FLAGS_random_per_batch_datapoint_processing) {
 		for (int thread = 0; thread < FLAGS_n_threads; thread++) {
 		    int batch = 0;
-		    for (int index = 0; index < partitions.NumDatapointsInBatch(thread, batch); index++) {
-			per_batch_datapoint_order[thread][batch][index] = rand() % partitions.NumDatapointsInBatch(thread, batch);
+		    for (DatapointIndex index = 0; index < partitions.NumDatapointsInBatch(thread, batch); index++) {
+			datapoint_order[thread][index] = rand() % partitions.NumDatapointsInBatch(thread, batch);
 		    }
 		}
 	    }
@@ -70,12 +78,16 @@ public:
 #pragma omp parallel for schedule(static, 1)
 	    for (int thread = 0; thread < FLAGS_n_threads; thread++) {
 		int batch = 0; // Hogwild only has 1 batch.
-		for (int index_count = 0; index_count < partitions.NumDatapointsInBatch(thread, batch); index_count++) {
-		    int index = per_batch_datapoint_order[thread][batch][index_count];
+		DatapointIndex n_datapoints = partitions.NumDatapointsInBatch(thread, batch);
+		const DatapointIndex *order = FLAGS_random_per_batch_datapoint_processing ? datapoint_order[thread].data() : NULL;
+		auto datapoint_at = [&](DatapointIndex i) { return partitions.GetDatapoint(thread, batch, order ? order[i] : i); };
+		for (DatapointIndex index_count = 0; index_count < n_datapoints; index_count++) {
+		    this->PrefetchAhead(updater, index_count, n_datapoints, datapoint_at);
+		    DatapointIndex index = order ? order[index_count] : index_count;
 		    updater->Update(model, partitions.GetDatapoint(thread, batch, index));
 		}
 	    }
-	    updater->EpochFinish();
+	    this->EpochFinish(epoch, updater, &stats);
 	}
 	return stats;
     }
@@ -22,11 +22,19 @@
 DEFINE_bool(random_batch_processing, false, "Process batches in random order. Note this may disrupt catch-up.");
 DEFINE_bool(random_per_batch_datapoint_processing, false, "Process datapoints in random order per batch. Note this may disrupt catch-up.");
 DEFINE_int32(interval_print, 1, "Interval in which to print the loss.");
+DEFINE_bool(relocate_datapoints, false, "After partitioning, copy each thread's datapoints in processing order into a contiguous arena allocated by the thread.");
+DEFINE_int32(prefetch_distance, 0, "Number of datapoints ahead in a thread's list to software prefetch the coordinates and model rows of. 0 disables prefetching.");
 
-// Contains times / losses / etc
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+// Contains times / losses / etc (times and losses at the epochs the loss is
+// printed at, see Trainer::EpochBegin)
 struct TrainStatistics {
     std::vector<double> times;
     std::vector<double> losses;
+    std::vector<double> epoch_finish_times;
 };
 
 typedef struct TrainStatistics TrainStatistics;
@@ -39,6 +47,48 @@ protected:
 	stats->losses.push_back(cur_loss);
     }
 
+    // Prefetch every cache line of [data, data + bytes).
+    inline void PrefetchRange(const void *data, size_t bytes, bool for_write) {
+	const char *start = (const char *)data;
+	for (size_t offset = 0; offset < bytes; offset += CACHE_LINE_SIZE) {
+	    if (for_write) __builtin_prefetch(start + offset, 1);
+	    else __builtin_prefetch(start + offset, 0);
+	}
+    }
+
+    // Software prefetching for the update of the datapoint at position index
+    // of a thread's list of n_datapoints, where datapoint_at(i) returns the
+    // datapoint at position i. Each access depends on the previous one, so
+    // they are prefetched in stages, one prefetch distance apart, so that none
+    // of them waits on a miss: the datapoint object 3 distances ahead, its
+    // coordinates and weights 2 distances ahead, and the model rows it
+    // touches 1 distance ahead, in the copy of the model the updater trains
+    // on (see Updater::UpdateData).
+    template <class DatapointAt>
+    inline void PrefetchAhead(Updater *updater, DatapointIndex index, DatapointIndex n_datapoints, DatapointAt datapoint_at) {
+	int distance = FLAGS_prefetch_distance;
+	if (distance <= 0) return;
+	if (index + 3 * distance < n_datapoints) {
+	    // The object's header and the vectors of its subclass follow the vtable pointer.
+	    PrefetchRange(datapoint_at(index + 3 * distance), 2 * CACHE_LINE_SIZE, false);
+	}
+	if (index + 2 * distance < n_datapoints) {
+	    Datapoint *datapoint = datapoint_at(index + 2 * distance);
+	    const DatapointCoordinates &coordinates = datapoint->GetCoordinates();
+	    const DatapointWeights &weights = datapoint->GetWeights();
+	    PrefetchRange(coordinates.data(), coordinates.size() * sizeof(int), false);
+	    PrefetchRange(weights.data(), weights.size() * sizeof(double), false);
+	}
+	if (index + distance < n_datapoints) {
+	    Datapoint *datapoint = datapoint_at(index + distance);
+	    size_t row_bytes;
+	    const char *model_data = updater->UpdateData(row_bytes);
+	    for (const auto &coordinate : datapoint->GetCoordinates()) {
+		PrefetchRange(model_data + (size_t)coordinate * row_bytes, row_bytes, true);
+	    }
+	}
+    }
+
     void PrintPartitionTime(Timer &timer) {
 	printf("Partition Time(s): %f\n", timer.Elapsed());
     }
@@ -47,13 +97,47 @@ protected:
 	printf("Epoch: %d\tTime(s): %f\tLoss: %lf\t\n", epoch, cur_time, cur_loss);
     }
 
-    void EpochBegin(int epoch, Timer &gradient_timer, Model *model, const std::vector<Datapoint *> &datapoints, TrainStatistics *stats) {
+    void PrintEpochFinishTime(double epoch_finish_time, int epoch) {
+	printf("Epoch: %d\tEpoch Finish Time(s): %f\n", epoch, epoch_finish_time);
+    }
+
+    // Let the updater finish the epoch, timing it separately from the updates.
+    void EpochFinish(int epoch, Updater *updater, TrainStatistics *stats) {
+	Timer epoch_finish_timer;
+	updater->EpochFinish();
+	double epoch_finish_time = epoch_finish_timer.Elapsed();
+	stats->epoch_finish_times.push_back(epoch_finish_time);
+	if (FLAGS_print_epoch_finish_time) {
+	    this->PrintEpochFinishTime(epoch_finish_time, epoch);
+	}
+    }
+
+    // Place the data once partitioned: with FLAGS_relocate_datapoints, copy
+    // each thread's datapoints into an arena of its own, and with
+    // FLAGS_numa_placement, move them to the thread's NUMA node (relocation
+    // does that too) and place the model's pages on the nodes.
+    void PlaceData(Model *model, DatapointPartitions &partitions) {
+	if (FLAGS_relocate_datapoints) {
+	    partitions.Relocate();
+	}
+	else if (FLAGS_numa_placement) {
+	    partitions.Localize();
+	}
+	if (FLAGS_numa_placement) {
+	    NumaTopology::Get().PlaceModel(model->ModelData(), model->NumParameters(), model->RowStride());
+	}
+    }
+
+    // Compute and print the loss, at the epochs it is printed at only: the
+    // updater may have to store its copy of the model back first (see
+    // Updater::SyncModel).
+    void EpochBegin(int epoch, Timer &gradient_timer, Model *model, Updater *updater, const std::vector<Datapoint *> &datapoints, TrainStatistics *stats) {
+	if (!FLAGS_print_loss_per_epoch || epoch % FLAGS_interval_print != 0) return;
 	double cur_time = gradient_timer.Elapsed();
+	updater->SyncModel();
 	double cur_loss = model->ComputeLoss(datapoints);
 	this->TrackTimeLoss(cur_time, cur_loss, stats);
-	if (FLAGS_print_loss_per_epoch && epoch % FLAGS_interval_print == 0) {
-	    this->PrintTimeLoss(cur_time, cur_loss, epoch);
-	}
+	this->PrintTimeLoss(cur_time, cur_loss, epoch);
     }
 
 public:
@@ -68,7 +152,12 @@ public:
 	omp_set_num_threads(FLAGS_n_threads);
 #pragma omp parallel
 	{
-	    pin_to_core(omp_get_thread_num());
+	    if (FLAGS_numa_placement) {
+		NumaTopology::Get().PinThread(omp_get_thread_num(), FLAGS_n_threads);
+	    }
+	    else {
+		pin_to_core(omp_get_thread_num());
+	    }
 	}
     }
     virtual ~Trainer() {}
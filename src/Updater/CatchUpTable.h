@@ -0,0 +1,85 @@
+/*
+* Copyright 2016 [See AUTHORS file for list of authors]
+*
+*    Licensed under the Apache License, Version 2.0 (the "License");
+*    you may not use this file except in compliance with the License.
+*    You may obtain a copy of the License at
+*
+*        http://www.apache.org/licenses/LICENSE-2.0
+*
+*    Unless required by applicable law or agreed to in writing, software
+*    distributed under the License is distributed on an "AS IS" BASIS,
+*    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*    See the License for the specific language governing permissions and
+*    limitations under the License.
+*/
+
+#ifndef _CATCH_UP_TABLE_
+#define _CATCH_UP_TABLE_
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "../Datapoint/DatapointIndex.h"
+
+DEFINE_int32(catch_up_table_size, 1 << 16, "Most staleness values the closed form catch up table holds (16 bytes each). Catching up over more falls back to pow.");
+
+// Precomputed closed form catch up coefficients for a mu that is the same
+// for every coordinate and every update.
+//
+// Catching a coordinate up over diff skipped updates computes
+//   x = (1 - mu)^diff * x - nu * geom_sum(diff),
+//   geom_sum(diff) = (1 - (1 - mu)^(diff+1)) / mu - 1.
+// Both factors only depend on diff, so they are tabulated (side by side, so
+// that a lookup touches a single cache line) for diff up to the maximum
+// staleness, capped at FLAGS_catch_up_table_size entries, turning catch up
+// into a lookup and a multiply-add. With mu == 0 catch up is the identity
+// (as far as mu goes), so no table is built.
+//
+// A static lambda that differs between coordinates isn't tabulated: that
+// takes a table per coordinate, NumParameters() times the memory, and no
+// model has one. Catch up with it computes a single pow per coordinate
+// (see Updater::CatchUp).
+class CatchUpTable {
+ private:
+    struct Entry {
+	double decay;
+	double geom_sum;
+    };
+    std::vector<Entry> table;
+
+ public:
+    CatchUpTable() {}
+    ~CatchUpTable() {}
+
+    void Initialize(double mu, DatapointIndex max_diff) {
+	table.clear();
+	if (mu == 0) return;
+	max_diff = std::min(max_diff, (DatapointIndex)FLAGS_catch_up_table_size - 1);
+	if (max_diff < 0) return;
+	table.resize(max_diff+1);
+	for (DatapointIndex diff = 0; diff <= max_diff; diff++) {
+	    table[diff].decay = pow(1 - mu, diff);
+	    table[diff].geom_sum = ((1 - pow(1 - mu, diff+1)) / (1 - (1 - mu))) - 1;
+	}
+    }
+
+    bool Enabled() {
+	return !table.empty();
+    }
+
+    // Whether diff is in the table (falls back to pow otherwise).
+    inline bool Covers(DatapointIndex diff) {
+	return diff < table.size();
+    }
+
+    inline double Decay(DatapointIndex diff) {
+	return table[diff].decay;
+    }
+
+    inline double GeomSum(DatapointIndex diff) {
+	return table[diff].geom_sum;
+    }
+};
+
+#endif
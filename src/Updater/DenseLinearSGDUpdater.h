@@ -22,55 +22,107 @@
 
 class DenseLinearSGDUpdater : public Updater {
 protected:
-    REGISTER_THREAD_LOCAL_1D_VECTOR(lambda);
-    REGISTER_THREAD_LOCAL_2D_VECTOR(kappa);
-    REGISTER_THREAD_LOCAL_2D_VECTOR(h_bar);
+    ThreadLocal1DVector lambda;
+    ThreadLocal2DVector kappa;
+    ThreadLocal2DVector h_bar;
 
-    void PrepareNu(std::vector<int> &coordinates) override {
-	std::vector<double> &cur_model = model->ModelData();
-	std::vector<std::vector<double> > &kappa = GET_THREAD_LOCAL_VECTOR(kappa);
+    // If lambda / kappa don't depend on the model (see Model::StaticLambda),
+    // they are computed for every coordinate once, at set up.
+    bool lambda_is_static, kappa_is_static;
+    REGISTER_GLOBAL_1D_VECTOR(static_lambda);
+    REGISTER_GLOBAL_1D_VECTOR(static_kappa);
+
+    void PrepareNu(int thread, DatapointCoordinates &coordinates) override {
+	if (kappa_is_static) return;
+	ModelVector &cur_model = model->ModelData();
+	std::vector<std::vector<double> > &local_kappa = kappa.Get(thread);
 	for (int i = 0; i < coordinates.size(); i++) {
 	    int index = coordinates[i];
-	    model->Kappa(index, kappa[index], cur_model);
+	    model->Kappa(index, local_kappa[index], cur_model);
 	}
     }
 
-    void PrepareMu(std::vector<int> &coordinates) override {
-	std::vector<double> &cur_model = model->ModelData();
-	std::vector<double> &lambda = GET_THREAD_LOCAL_VECTOR(lambda);
+    void PrepareMu(int thread, DatapointCoordinates &coordinates) override {
+	if (lambda_is_static) return;
+	ModelVector &cur_model = model->ModelData();
+	ModelVector &local_lambda = lambda.Get(thread);
 	for (int i = 0; i < coordinates.size(); i++) {
 	    int index = coordinates[i];
-	    model->Lambda(index, lambda[index], cur_model);
+	    model->Lambda(index, local_lambda[index], cur_model);
 	}
     }
 
-    void PrepareH(Datapoint *datapoint, Gradient *g) override {
-	std::vector<double> &cur_model = model->ModelData();
-	std::vector<std::vector<double> > &h_bar = GET_THREAD_LOCAL_VECTOR(h_bar);
+    void PrepareH(int thread, Datapoint *datapoint, Gradient *g) override {
+	ModelVector &cur_model = model->ModelData();
+	std::vector<std::vector<double> > &local_h_bar = h_bar.Get(thread);
 	model->PrecomputeCoefficients(datapoint, g, cur_model);
 	for (int i = 0; i < datapoint->GetCoordinates().size(); i++) {
 	    int index = datapoint->GetCoordinates()[i];
-	    model->H_bar(index, h_bar[index], g, cur_model);
+	    model->H_bar(index, local_h_bar[index], g, cur_model);
 	}
     }
 
-    double H(int coordinate, int index_into_coordinate_vector) {
-	return -GET_THREAD_LOCAL_VECTOR(h_bar)[coordinate][index_into_coordinate_vector] * FLAGS_learning_rate;
+    double H(int thread, int coordinate, int index_into_coordinate_vector) {
+	return -h_bar.Get(thread)[coordinate][index_into_coordinate_vector] * FLAGS_learning_rate;
+    }
+
+    double Nu(int thread, int coordinate, int index_into_coordinate_vector) {
+	if (kappa_is_static) {
+	    return -GET_GLOBAL_VECTOR(static_kappa)[coordinate*model->CoordinateSize()+index_into_coordinate_vector] * FLAGS_learning_rate;
+	}
+	return -kappa.Get(thread)[coordinate][index_into_coordinate_vector] * FLAGS_learning_rate;
     }
 
-    double Nu(int coordinate, int index_into_coordinate_vector) {
-	return -GET_THREAD_LOCAL_VECTOR(kappa)[coordinate][index_into_coordinate_vector] * FLAGS_learning_rate;
+    double Mu(int thread, int coordinate) {
+	if (lambda_is_static) {
+	    return GET_GLOBAL_VECTOR(static_lambda)[coordinate] * FLAGS_learning_rate;
+	}
+	return lambda.Get(thread)[coordinate] * FLAGS_learning_rate;
     }
 
-    double Mu(int coordinate) {
-	return GET_THREAD_LOCAL_VECTOR(lambda)[coordinate] * FLAGS_learning_rate;
+    void PrecomputeStaticLambdaKappa() {
+	ModelVector &cur_model = model->ModelData();
+	int coordinate_size = model->CoordinateSize();
+	if (lambda_is_static) {
+	    ModelVector &static_lambda = GET_GLOBAL_VECTOR(static_lambda);
+	    for (int i = 0; i < model->NumParameters(); i++) {
+		model->Lambda(i, static_lambda[i], cur_model);
+	    }
+
+	    // Same mu everywhere, so catch up can be tabulated.
+	    if (model->UniformLambda() && model->NumParameters() > 0) {
+		catch_up_table.Initialize(static_lambda[0] * FLAGS_learning_rate, MaxStaleness());
+	    }
+	}
+	if (kappa_is_static) {
+	    ModelVector &static_kappa = GET_GLOBAL_VECTOR(static_kappa);
+	    std::vector<double> kappa_coordinate(coordinate_size, 0);
+	    for (int i = 0; i < model->NumParameters(); i++) {
+		model->Kappa(i, kappa_coordinate, cur_model);
+		std::copy(kappa_coordinate.begin(), kappa_coordinate.end(), &static_kappa[i*coordinate_size]);
+	    }
+	}
     }
 
  public:
     DenseLinearSGDUpdater(Model *model, std::vector<Datapoint *> &datapoints) : Updater(model, datapoints) {
-	INITIALIZE_THREAD_LOCAL_1D_VECTOR(lambda, model->NumParameters());
-	INITIALIZE_THREAD_LOCAL_2D_VECTOR(kappa, model->NumParameters(), model->CoordinateSize());
-	INITIALIZE_THREAD_LOCAL_2D_VECTOR(h_bar, model->NumParameters(), model->CoordinateSize());
+	std::vector<double> zero_coordinate(model->CoordinateSize(), 0);
+	lambda_is_static = model->StaticLambda();
+	kappa_is_static = model->StaticKappa();
+	if (lambda_is_static) {
+	    INITIALIZE_GLOBAL_1D_VECTOR(static_lambda, model->NumParameters());
+	}
+	else {
+	    lambda.Initialize(FLAGS_n_threads, model->NumParameters(), 0.0);
+	}
+	if (kappa_is_static) {
+	    INITIALIZE_GLOBAL_1D_VECTOR(static_kappa, model->NumParameters() * model->CoordinateSize());
+	}
+	else {
+	    kappa.Initialize(FLAGS_n_threads, model->NumParameters(), zero_coordinate);
+	}
+	h_bar.Initialize(FLAGS_n_threads, model->NumParameters(), zero_coordinate);
+	PrecomputeStaticLambdaKappa();
     }
 
     ~DenseLinearSGDUpdater() {
@@ -0,0 +1,125 @@
+/*
+* Copyright 2016 [See AUTHORS file for list of authors]
+*
+*    Licensed under the Apache License, Version 2.0 (the "License");
+*    you may not use this file except in compliance with the License.
+*    You may obtain a copy of the License at
+*
+*        http://www.apache.org/licenses/LICENSE-2.0
+*
+*    Unless required by applicable law or agreed to in writing, software
+*    distributed under the License is distributed on an "AS IS" BASIS,
+*    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*    See the License for the specific language governing permissions and
+*    limitations under the License.
+*/
+
+#ifndef _FASTLSUPDATER_
+#define _FASTLSUPDATER_
+
+#include "Updater.h"
+#include "../Gradient/Gradient.h"
+#include "../Datapoint/LSDatapoint.h"
+
+DEFINE_int32(fast_least_squares_width, 8, "Number of conflict free datapoints the fast least squares updater processes at once, vectorized across datapoints.");
+
+// Fast sparse least squares SGD updater.
+// Rows of sparse least squares problems often have too few nonzeros for the
+// loops over a single datapoint to vectorize. Given a group of datapoints no
+// two of which share a coordinate (see UpdateIndependent), this lays the group
+// out one lane per datapoint and vectorizes the dot products and the updates
+// across datapoints, which gathers / scatters the model rows where the target
+// instruction set supports it. Results are the same as with SparseSGDUpdater.
+class FastLSSGDUpdater : public SparseSGDUpdater {
+protected:
+    // A group laid out lane major: entry k of lane l is at k * n_lanes + l.
+    // Lanes shorter than the longest are padded with zero weight entries at
+    // their own first coordinate, which leaves the model unchanged.
+    struct Lanes {
+	std::vector<Datapoint *> datapoints;
+	std::vector<int> offsets;
+	std::vector<double> weights;
+	std::vector<double> coeffs;
+    };
+    ThreadLocal<Lanes> lanes;
+
+    // Returns the number of lanes (datapoints with at least one coordinate).
+    int LayOutLanes(Lanes &group, Datapoint **datapoints, int n, int &max_nnz) {
+	group.datapoints.clear();
+	max_nnz = 0;
+	for (int i = 0; i < n; i++) {
+	    int nnz = datapoints[i]->GetCoordinates().size();
+	    if (nnz == 0) continue;
+	    group.datapoints.push_back(datapoints[i]);
+	    max_nnz = std::max(max_nnz, nnz);
+	}
+	int n_lanes = group.datapoints.size();
+	group.offsets.resize(max_nnz * n_lanes);
+	group.weights.resize(max_nnz * n_lanes);
+	group.coeffs.resize(n_lanes);
+	for (int lane = 0; lane < n_lanes; lane++) {
+	    const DatapointCoordinates &coordinates = group.datapoints[lane]->GetCoordinates();
+	    const DatapointWeights &weights = group.datapoints[lane]->GetWeights();
+	    for (int k = 0; k < max_nnz; k++) {
+		bool padding = k >= coordinates.size();
+		group.offsets[k * n_lanes + lane] = (padding ? coordinates[0] : coordinates[k]) * row_stride;
+		group.weights[k * n_lanes + lane] = padding ? 0 : weights[k];
+	    }
+	}
+	return n_lanes;
+    }
+
+public:
+    FastLSSGDUpdater(Model *model, std::vector<Datapoint *> &datapoints) : SparseSGDUpdater(model, datapoints) {
+	lanes.Initialize(FLAGS_n_threads);
+    }
+
+    ~FastLSSGDUpdater() {
+    }
+
+    int IndependentBatchWidth() override {
+	return std::max(1, FLAGS_fast_least_squares_width);
+    }
+
+    void UpdateIndependent(Model *model, Datapoint **datapoints, int n) override {
+	if (n == 1) {
+	    Update(model, datapoints[0]);
+	    return;
+	}
+	int thread = omp_get_thread_num();
+	Lanes &group = lanes.Get(thread);
+	double *model_data = ModelData(thread).data();
+	ModelVector &B = this->model->ExtraData();
+	int max_nnz = 0;
+	int n_lanes = LayOutLanes(group, datapoints, n, max_nnz);
+	double *coeffs = group.coeffs.data();
+
+	// Dot products, then the gradient coefficient of each lane.
+	for (int lane = 0; lane < n_lanes; lane++) {
+	    coeffs[lane] = 0;
+	}
+	for (int k = 0; k < max_nnz; k++) {
+	    const int *offsets = &group.offsets[k * n_lanes];
+	    const double *weights = &group.weights[k * n_lanes];
+#pragma omp simd
+	    for (int lane = 0; lane < n_lanes; lane++) {
+		coeffs[lane] += weights[lane] * model_data[offsets[lane]];
+	    }
+	}
+	for (int lane = 0; lane < n_lanes; lane++) {
+	    coeffs[lane] = 2 * (coeffs[lane] - B[((LSDatapoint *)group.datapoints[lane])->row]);
+	}
+
+	// Updates. Lanes share no coordinates, so the scatters don't conflict.
+	for (int k = 0; k < max_nnz; k++) {
+	    const int *offsets = &group.offsets[k * n_lanes];
+	    const double *weights = &group.weights[k * n_lanes];
+#pragma omp simd
+	    for (int lane = 0; lane < n_lanes; lane++) {
+		model_data[offsets[lane]] += -(coeffs[lane] * weights[lane]) * FLAGS_learning_rate;
+	    }
+	}
+    }
+};
+
+#endif
@@ -17,64 +17,105 @@
 #ifndef _FASTMCUPDATER_
 #define _FASTMCUPDATER_
 
+#include <type_traits>
 #include "Updater.h"
 #include "../Gradient/Gradient.h"
+#include "../Precision/Precision.h"
 
 // Fast matrix completion SGD updater.
+// Trains on the model in Storage precision (see --model_precision). For
+// anything but double the updates go to a ReducedPrecisionModel, loaded
+// from the model once, and stored back whenever the model is read (see
+// SyncModel).
+template <class Storage = double>
 class FastMCSGDUpdater : public SparseSGDUpdater {
 protected:
+    typedef typename ComputeType<Storage>::type Real;
 
-    void PrepareMCGradient(Datapoint *datapoint, Gradient *g) {
+    ReducedPrecisionModel<Storage> reduced_model;
+
+    inline Storage * Parameters(int thread) {
+	if (std::is_same<Storage, double>::value) {
+	    return reinterpret_cast<Storage *>(ModelData(thread).data());
+	}
+	return reduced_model.Data();
+    }
+
+    // Stride, in Storage values, of the rows of Parameters().
+    inline int ParametersStride() {
+	if (std::is_same<Storage, double>::value) {
+	    return row_stride;
+	}
+	return reduced_model.RowStride();
+    }
+
+    void PrepareMCGradient(int thread, Datapoint *datapoint, Gradient *g) {
 	if (g->coeffs.size() != 1) g->coeffs.resize(1);
-	const std::vector<double> &labels = datapoint->GetWeights();
-	const std::vector<int> &coordinates = datapoint->GetCoordinates();
-	std::vector<double> &model_data = model->ModelData();
+	const DatapointWeights &labels = datapoint->GetWeights();
+	const DatapointCoordinates &coordinates = datapoint->GetCoordinates();
+	Storage *model_data = Parameters(thread);
+	int stride = ParametersStride();
 	int rlength = model->CoordinateSize();
 	int user_coordinate = coordinates[0];
 	int movie_coordinate = coordinates[1];
 	double label = labels[0];
-	double coeff = 0;
+	Real coeff = 0;
 	for (int i = 0; i < rlength; i++) {
-	    coeff += model_data[user_coordinate*rlength+i] * model_data[movie_coordinate*rlength+i];
+	    coeff += (Real)model_data[user_coordinate*stride+i] * (Real)model_data[movie_coordinate*stride+i];
 	}
-	coeff -= label;
-	g->coeffs[0] = coeff;
+	g->coeffs[0] = coeff - label;
     }
 
-    void ApplyMCGradient(Datapoint *datapoint, Gradient *gradient) {
+    void ApplyMCGradient(int thread, Datapoint *datapoint, Gradient *gradient) {
 	// Custom SGD. This is fast because it avoids intermediate writes to memory,
 	// and simply updates the model directly and simultaneously.
-	double gradient_coefficient = gradient->coeffs[0];
-	const std::vector<int> &coordinates = datapoint->GetCoordinates();
-	std::vector<double> &model_data = model->ModelData();
+	Real step = FLAGS_learning_rate * gradient->coeffs[0];
+	const DatapointCoordinates &coordinates = datapoint->GetCoordinates();
+	Storage *model_data = Parameters(thread);
+	int stride = ParametersStride();
 	int rlength = model->CoordinateSize();
 	int user_coordinate = coordinates[0];
 	int movie_coordinate = coordinates[1];
+	if (IsHub(user_coordinate) || IsHub(movie_coordinate)) {
+	    ApplyMCGradientToHubs(model_data, user_coordinate, movie_coordinate, step);
+	    return;
+	}
+	for (int i = 0; i < rlength; i++) {
+	    Real user_value = model_data[user_coordinate*stride+i];
+	    Real movie_value = model_data[movie_coordinate*stride+i];
+	    model_data[user_coordinate*stride+i] = (Storage)(user_value - step * movie_value);
+	    model_data[movie_coordinate*stride+i] = (Storage)(movie_value - step * user_value);
+	}
+    }
+
+    // The same update, adding to the rows of hub coordinates atomically.
+    void ApplyMCGradientToHubs(Storage *model_data, int user_coordinate, int movie_coordinate, Real step) {
+	int rlength = model->CoordinateSize();
+	int stride = ParametersStride();
+	bool user_hub = IsHub(user_coordinate), movie_hub = IsHub(movie_coordinate);
 	for (int i = 0; i < rlength; i++) {
-	    double new_user_value = model_data[user_coordinate*rlength+i] -
-		FLAGS_learning_rate * gradient_coefficient * model_data[movie_coordinate*rlength+i];
-	    double new_movie_value = model_data[movie_coordinate*rlength+i] -
-		FLAGS_learning_rate * gradient_coefficient * model_data[user_coordinate*rlength+i];
-	    model_data[user_coordinate*rlength+i] = new_user_value;
-	    model_data[movie_coordinate*rlength+i] = new_movie_value;
+	    Storage *user = &model_data[user_coordinate*stride+i];
+	    Storage *movie = &model_data[movie_coordinate*stride+i];
+	    Real user_value = *user;
+	    Real movie_value = *movie;
+	    if (user_hub) AtomicAdd(user, -step * movie_value);
+	    else *user = (Storage)(user_value - step * movie_value);
+	    if (movie_hub) AtomicAdd(movie, -step * user_value);
+	    else *movie = (Storage)(movie_value - step * user_value);
 	}
     }
 
     // Note that the Update method is called by many threads.
     // So we have thread local gradients to avoid conflicts.
     void Update(Model *model, Datapoint *datapoint) override {
-	int thread_num = omp_get_thread_num();
-	thread_gradients[thread_num].Clear();
-	thread_gradients[thread_num].datapoint = datapoint;
+	int thread = omp_get_thread_num();
+	Gradient &gradient = thread_gradients.Get(thread);
+	gradient.Clear();
+	gradient.datapoint = datapoint;
 
 	// Prepare and apply gradient.
-	PrepareMCGradient(datapoint, &thread_gradients[thread_num]);
-	ApplyMCGradient(datapoint, &thread_gradients[thread_num]);
-
-	// Update bookkeeping.
-	for (const auto &coordinate : datapoint->GetCoordinates()) {
-	    bookkeeping[coordinate] = datapoint->GetOrder();
-	}
+	PrepareMCGradient(thread, datapoint, &gradient);
+	ApplyMCGradient(thread, datapoint, &gradient);
     }
 
  public:
@@ -83,6 +124,32 @@ protected:
 
     ~FastMCSGDUpdater() {
     }
+
+    const char *UpdateData(size_t &row_bytes) override {
+	row_bytes = ParametersStride() * sizeof(Storage);
+	if (std::is_same<Storage, double>::value) {
+	    return (const char *)model->ModelData().data();
+	}
+	return (const char *)reduced_model.Data();
+    }
+
+    // Gathered rows are in double.
+    bool CanGatherUpdates() override {
+	return std::is_same<Storage, double>::value && SparseSGDUpdater::CanGatherUpdates();
+    }
+
+    void EpochBegin() override {
+	SparseSGDUpdater::EpochBegin();
+	if (!std::is_same<Storage, double>::value) {
+	    reduced_model.Acquire(model->ModelData(), row_stride, model->CoordinateSize(), FLAGS_n_threads);
+	}
+    }
+
+    void SyncModel() override {
+	if (!std::is_same<Storage, double>::value) {
+	    reduced_model.Sync(model->ModelData(), row_stride, model->CoordinateSize(), FLAGS_n_threads);
+	}
+    }
 };
 
 #endif
@@ -0,0 +1,103 @@
+/*
+* Copyright 2016 [See AUTHORS file for list of authors]
+*
+*    Licensed under the Apache License, Version 2.0 (the "License");
+*    you may not use this file except in compliance with the License.
+*    You may obtain a copy of the License at
+*
+*        http://www.apache.org/licenses/LICENSE-2.0
+*
+*    Unless required by applicable law or agreed to in writing, software
+*    distributed under the License is distributed on an "AS IS" BASIS,
+*    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+*    See the License for the specific language governing permissions and
+*    limitations under the License.
+*/
+
+#ifndef _LAZY_SAGA_UPDATER_
+#define _LAZY_SAGA_UPDATER_
+
+#include "SAGAUpdater.h"
+
+// SAGA with just-in-time catch up that stays correct under hogwild.
+//
+// The average gradient of a coordinate only changes when a datapoint touching
+// it is processed, and every such update first catches the coordinate up. So
+// sum_gradients[coordinate] is exactly the snapshot of the average in effect
+// since the last touch of the coordinate, recorded along with the time of that
+// touch in bookkeeping, and catching up applies diff * that snapshot.
+//
+// Three things make this hold with many threads:
+// - Time is not the datapoint order. Each datapoint is given a timestamp from
+//   its position in the partitions: the datapoints of a thread in a batch are
+//   spread evenly over that batch's time steps, interleaved with the other
+//   threads. Under cyclades conflicting datapoints are in the same thread so
+//   timestamps of a coordinate increase; under hogwild they approximate the
+//   real interleaving.
+// - An update claims the interval to catch a coordinate up over by moving its
+//   last touch forward with a compare and swap (see Updater::AdvanceTouch),
+//   so no interval is caught up twice or skipped, and bookkeeping only ever
+//   moves forward.
+// - Changes to the model and to sum_gradients are atomic adds, so none of
+//   them are lost to concurrent updates of the same coordinate.
+class LazySAGAUpdater : public SAGAUpdater {
+ protected:
+    // Timestamp of each datapoint (indexed by order-1), in [1, n_datapoints].
+    std::vector<DatapointIndex> timestamps;
+
+    void ComputeTimestamps(DatapointPartitions &partitions) {
+	int n_threads = FLAGS_n_threads;
+	DatapointIndex batch_start = 0;
+	timestamps.resize(datapoints.size());
+	for (int batch = 0; batch < partitions.NumBatches(); batch++) {
+	    DatapointIndex batch_size = 0;
+	    for (int thread = 0; thread < n_threads; thread++) {
+		batch_size += partitions.NumDatapointsInBatch(thread, batch);
+	    }
+	    for (int thread = 0; thread < n_threads; thread++) {
+		long long n_in_thread = partitions.NumDatapointsInBatch(thread, batch);
+		for (DatapointIndex index = 0; index < n_in_thread; index++) {
+		    long long slot = ((long long)index * n_threads + thread) * (long long)batch_size / (n_in_thread * n_threads);
+		    DatapointIndex order = partitions.GetDatapoint(thread, batch, index)->GetOrder();
+		    timestamps[order-1] = batch_start + slot + 1;
+		}
+	    }
+	    batch_start += batch_size;
+	}
+    }
+
+ public:
+    LazySAGAUpdater(Model *model, std::vector<Datapoint *> &datapoints) : SAGAUpdater(model, datapoints) {
+	// A single thread updates no coordinate concurrently.
+	atomic_updates = FLAGS_n_threads > 1;
+    }
+
+    ~LazySAGAUpdater() {}
+
+    void SetUpWithPartitions(DatapointPartitions &partitions) override {
+	SAGAUpdater::SetUpWithPartitions(partitions);
+	ComputeTimestamps(partitions);
+    }
+
+    void Update(Model *model, Datapoint *datapoint) override {
+	int thread = omp_get_thread_num();
+	Gradient &gradient = thread_gradients.Get(thread);
+	gradient.Clear();
+	gradient.datapoint = datapoint;
+	const DatapointCoordinates &coordinates = datapoint->GetCoordinates();
+	ModelVector &model_data = model->ModelData();
+	DatapointIndex timestamp = timestamps[datapoint->GetOrder()-1];
+
+	// Catch up with the average in effect since each coordinate's last touch.
+	for (int i = 0; i < coordinates.size(); i++) {
+	    DatapointIndex last_touch = AdvanceTouch(model_data, coordinates[i], timestamp);
+	    CatchUp(thread, coordinates[i], timestamp - last_touch - 1);
+	}
+
+	PrepareH(thread, datapoint, &gradient);
+	ApplyGradient(thread, datapoint);
+	UpdateGradientTable(thread, datapoint);
+    }
+};
+
+#endif
@@ -24,86 +24,175 @@ class SAGAUpdater: public Updater {
  protected:
 
     // Data structures for capturing the gradient.
-    REGISTER_THREAD_LOCAL_2D_VECTOR(h);
-    REGISTER_THREAD_LOCAL_DOUBLE(datapoint_order);
+    ThreadLocal2DVector h;
 
     // SAGA data structures.
-    REGISTER_GLOBAL_2D_VECTOR(sum_gradients);
-    std::vector<std::map<int, std::vector<double> > > prev_gradients;
+    REGISTER_GLOBAL_1D_VECTOR(sum_gradients);
+
+    // Table of the last gradient seen at each datapoint (indexed by order-1).
+    // If the model's gradient is a scalar times the datapoint's weights
+    // (see Model::HasScalarGradient) and coordinates are single doubles,
+    // only that scalar is stored per datapoint.
+    // Otherwise, the full gradient is stored flat, aligned with the datapoint's
+    // coordinates: entries prev_gradient_offsets[dp] + i*CoordinateSize() + j
+    // hold the gradient of the i'th coordinate of datapoint dp.
+    bool scalar_gradients;
+    ModelVector prev_gradients;
+    std::vector<size_t> prev_gradient_offsets;
+
+    // Whether to apply changes to the model and sum_gradients as atomic
+    // adds, so that none is lost when threads update a coordinate at once
+    // (see LazySAGAUpdater).
+    bool atomic_updates;
+
+    inline void Add(double *value, double delta) {
+	if (atomic_updates) {
+	    AtomicAdd(value, delta);
+	}
+	else {
+	    *value += delta;
+	}
+    }
 
-    void CatchUp(int index, int diff) override {
+    void CatchUp(int thread, int index, DatapointIndex diff) override {
 	if (diff < 0) {
 	    diff = 0;
 	}
-	for (int j = 0; j < model->CoordinateSize(); j++) {
-	    model->ModelData()[index*model->CoordinateSize()+j] -=
-		FLAGS_learning_rate*diff*GET_GLOBAL_VECTOR(sum_gradients)[index][j] / datapoints.size();
+	ModelVector &sum_gradients = GET_GLOBAL_VECTOR(sum_gradients);
+	int coordinate_size = model->CoordinateSize();
+	for (int j = 0; j < coordinate_size; j++) {
+	    Add(&model->ModelData()[index*row_stride+j],
+		-FLAGS_learning_rate*diff*sum_gradients[index*coordinate_size+j] / datapoints.size());
 	}
     }
 
-    void PrepareNu(std::vector<int> &coordinates) override {
+    void PrepareNu(int thread, DatapointCoordinates &coordinates) override {
 	// Assuming gradients are sparse, nu should be 0.
     }
 
-    void PrepareMu(std::vector<int> &coordinates) override {
+    void PrepareMu(int thread, DatapointCoordinates &coordinates) override {
 	// We also assume mu is 0.
     }
 
-    void PrepareH(Datapoint *datapoint, Gradient *g) override {
-	std::vector<double> &cur_model = model->ModelData();
-	std::vector<std::vector<double> > &h = GET_THREAD_LOCAL_VECTOR(h);
+    void PrepareH(int thread, Datapoint *datapoint, Gradient *g) override {
+	ModelVector &cur_model = model->ModelData();
 	model->PrecomputeCoefficients(datapoint, g, cur_model);
+
+	// Scalar gradients are read directly off of g->scalar_coeff.
+	if (scalar_gradients) {
+	    return;
+	}
+	std::vector<std::vector<double> > &local_h = h.Get(thread);
 	for (int i = 0; i < datapoint->GetCoordinates().size(); i++) {
 	    int index = datapoint->GetCoordinates()[i];
-	    model->H_bar(index, h[index], g, cur_model);
+	    model->H_bar(index, local_h[index], g, cur_model);
 	}
-	GET_THREAD_LOCAL_VECTOR(datapoint_order) = datapoint->GetOrder()-1;
     }
 
-    double H(int coordinate, int index_into_coordinate_vector) override {
-	int datapoint_order = GET_THREAD_LOCAL_VECTOR(datapoint_order);
-	return FLAGS_learning_rate * (-GET_THREAD_LOCAL_VECTOR(h)[coordinate][index_into_coordinate_vector]
-				      + prev_gradients[datapoint_order][coordinate][index_into_coordinate_vector]
-				      - GET_GLOBAL_VECTOR(sum_gradients)[coordinate][index_into_coordinate_vector] / datapoints.size());
+    // SAGA applies its gradient directly in ApplyGradient, where the position
+    // of each coordinate within the datapoint (needed to index
+    // prev_gradients) is known, so H is never called.
+    double H(int thread, int coordinate, int index_into_coordinate_vector) override {
+	return 0;
     }
 
-    double Nu(int coordinate, int index_into_coordinate_vector) override {
+    double Nu(int thread, int coordinate, int index_into_coordinate_vector) override {
 	return 0;
     }
 
-    double Mu(int coordinate) override {
+    double Mu(int thread, int coordinate) override {
 	return 0;
     }
 
+    void ApplyGradient(int thread, Datapoint *datapoint) override {
+	ModelVector &model_data = model->ModelData();
+	ModelVector &sum_gradients = GET_GLOBAL_VECTOR(sum_gradients);
+	const DatapointCoordinates &coordinates = datapoint->GetCoordinates();
+	int coordinate_size = model->CoordinateSize();
+	DatapointIndex dp_order = datapoint->GetOrder()-1;
+	double n_datapoints = datapoints.size();
+
+	if (scalar_gradients) {
+	    const DatapointWeights &weights = datapoint->GetWeights();
+	    double coeff_diff = thread_gradients.Get(thread).scalar_coeff - prev_gradients[dp_order];
+	    for (int i = 0; i < coordinates.size(); i++) {
+		int index = coordinates[i];
+		Add(&model_data[index*row_stride], -FLAGS_learning_rate * (coeff_diff * weights[i] + sum_gradients[index] / n_datapoints));
+	    }
+	    return;
+	}
+
+	std::vector<std::vector<double> > &local_h = h.Get(thread);
+	double *prev = &prev_gradients[prev_gradient_offsets[dp_order]];
+	for (int i = 0; i < coordinates.size(); i++) {
+	    int index = coordinates[i];
+	    for (int j = 0; j < coordinate_size; j++) {
+		Add(&model_data[index*row_stride+j], -FLAGS_learning_rate *
+		    (local_h[index][j] - prev[i*coordinate_size+j] + sum_gradients[index*coordinate_size+j] / n_datapoints));
+	    }
+	}
+    }
+
+    // Record the gradient just computed at datapoint in the gradient table, and
+    // add the change in gradient to sum_gradients.
+    void UpdateGradientTable(int thread, Datapoint *datapoint) {
+	ModelVector &sum_gradients = GET_GLOBAL_VECTOR(sum_gradients);
+	const DatapointCoordinates &coordinates = datapoint->GetCoordinates();
+	int coordinate_size = model->CoordinateSize();
+	DatapointIndex dp_order = datapoint->GetOrder()-1;
+
+	if (scalar_gradients) {
+	    const DatapointWeights &weights = datapoint->GetWeights();
+	    double coeff = thread_gradients.Get(thread).scalar_coeff;
+	    double coeff_diff = coeff - prev_gradients[dp_order];
+	    for (int i = 0; i < coordinates.size(); i++) {
+		Add(&sum_gradients[coordinates[i]], coeff_diff * weights[i]);
+	    }
+	    prev_gradients[dp_order] = coeff;
+	    return;
+	}
+
+	std::vector<std::vector<double> > &local_h = h.Get(thread);
+	double *prev = &prev_gradients[prev_gradient_offsets[dp_order]];
+	for (int i = 0; i < coordinates.size(); i++) {
+	    int index = coordinates[i];
+	    for (int j = 0; j < coordinate_size; j++) {
+		Add(&sum_gradients[index*coordinate_size+j], local_h[index][j] - prev[i*coordinate_size+j]);
+		prev[i*coordinate_size+j] = local_h[index][j];
+	    }
+	}
+    }
+
     void Update(Model *model, Datapoint *datapoint) {
 	Updater::Update(model, datapoint);
 
 	// Update prev and sum gradients.
-	int dp_order = datapoint->GetOrder()-1;
-	for (const auto &index : datapoint->GetCoordinates()) {
-	    for (int i = 0; i < model->CoordinateSize(); i++) {
-		GET_GLOBAL_VECTOR(sum_gradients)[index][i] += GET_THREAD_LOCAL_VECTOR(h)[index][i] - prev_gradients[dp_order][index][i];
-		prev_gradients[dp_order][index][i] = GET_THREAD_LOCAL_VECTOR(h)[index][i];
-	    }
-	}
+	UpdateGradientTable(omp_get_thread_num(), datapoint);
     }
 
  public:
     SAGAUpdater(Model *model, std::vector<Datapoint *>&datapoints): Updater(model, datapoints) {
-	INITIALIZE_THREAD_LOCAL_2D_VECTOR(h, model->NumParameters(), model->CoordinateSize());
-	INITIALIZE_GLOBAL_2D_VECTOR(sum_gradients, model->NumParameters(), model->CoordinateSize());
-	INITIALIZE_THREAD_LOCAL_DOUBLE(datapoint_order);
-
-	// I hope this problem is sparse enough!
-	prev_gradients.resize(datapoints.size());
-	for (int i = 0; i < datapoints.size(); i++) {
-	    int order = datapoints[i]->GetOrder()-1;
-	    for (const auto &index : datapoints[i]->GetCoordinates()) {
-		prev_gradients[order][index].resize(model->CoordinateSize());
-		std::fill(prev_gradients[order][index].begin(),
-			  prev_gradients[order][index].end(), 0);
-	    }
+	INITIALIZE_GLOBAL_1D_VECTOR(sum_gradients, model->NumParameters() * model->CoordinateSize());
+	atomic_updates = false;
+
+	scalar_gradients = model->HasScalarGradient() && model->CoordinateSize() == 1;
+	if (scalar_gradients) {
+	    prev_gradients.resize(datapoints.size(), 0);
+	    return;
+	}
+
+	h.Initialize(FLAGS_n_threads, model->NumParameters(), std::vector<double>(model->CoordinateSize(), 0));
+
+	// Lay out the gradient table in datapoint order.
+	prev_gradient_offsets.resize(datapoints.size()+1, 0);
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
+	    DatapointIndex order = datapoints[i]->GetOrder()-1;
+	    prev_gradient_offsets[order+1] = datapoints[i]->GetCoordinates().size() * model->CoordinateSize();
+	}
+	for (DatapointIndex i = 0; i < datapoints.size(); i++) {
+	    prev_gradient_offsets[i+1] += prev_gradient_offsets[i];
 	}
+	prev_gradients.resize(prev_gradient_offsets[datapoints.size()], 0);
     }
 
     ~SAGAUpdater() {}
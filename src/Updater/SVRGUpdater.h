@@ -17,157 +17,262 @@
 #ifndef _SVRG_UPDATER_
 #define _SVRG_UPDATER_
 
+#include <limits.h>
 #include "Updater.h"
 #include "../Gradient/Gradient.h"
 
+DEFINE_int32(svrg_snapshot_interval_epochs, 1, "For SVRG, take a snapshot of the model (and its full gradient) every this many epochs.");
+DEFINE_bool(svrg_cache_snapshot_coefficients, false, "For SVRG, cache each datapoint's gradient coefficient at the snapshot (8 bytes per datapoint) rather than recomputing it every update. Only applies to models with scalar coefficients.");
+
+// Per-coordinate sums of gradients, owned by a single thread.
+// Only the coordinates that were added to are tracked, so that merging
+// two accumulators and clearing one costs time proportional to the number
+// of coordinates touched rather than the size of the model.
+class SparseGradientAccumulator {
+ private:
+    int coordinate_size;
+    ModelVector values;
+    std::vector<char> touched;
+    std::vector<int> touched_coordinates;
+
+ public:
+    SparseGradientAccumulator(int n_coordinates, int coordinate_size) {
+	this->coordinate_size = coordinate_size;
+	values.resize(n_coordinates * coordinate_size, 0);
+	touched.resize(n_coordinates, 0);
+    }
+
+    // Row of the sums for coordinate, to be added into.
+    double *Row(int coordinate) {
+	if (!touched[coordinate]) {
+	    touched[coordinate] = 1;
+	    touched_coordinates.push_back(coordinate);
+	}
+	return &values[coordinate * coordinate_size];
+    }
+
+    double Value(int coordinate, int index_into_coordinate_vector) {
+	return values[coordinate * coordinate_size + index_into_coordinate_vector];
+    }
+
+    // Add other's sums into this accumulator, and clear other.
+    void MergeFrom(SparseGradientAccumulator &other) {
+	for (const auto &coordinate : other.touched_coordinates) {
+	    double *row = Row(coordinate);
+	    double *other_row = &other.values[coordinate * coordinate_size];
+	    for (int j = 0; j < coordinate_size; j++) {
+		row[j] += other_row[j];
+		other_row[j] = 0;
+	    }
+	    other.touched[coordinate] = 0;
+	}
+	other.touched_coordinates.clear();
+    }
+
+    void Clear() {
+	for (const auto &coordinate : touched_coordinates) {
+	    std::fill(&values[coordinate * coordinate_size], &values[(coordinate+1) * coordinate_size], 0);
+	    touched[coordinate] = 0;
+	}
+	touched_coordinates.clear();
+    }
+};
+
 class SVRGUpdater : public Updater {
 protected:
-    double n_updates_so_far;
+    // Epochs started since the last snapshot.
+    int n_epochs_since_snapshot;
 
-    std::vector<double> model_copy;
+    ModelVector model_copy;
     // Vectors for computing SVRG related data.
-    REGISTER_THREAD_LOCAL_1D_VECTOR(lambda);
-    REGISTER_THREAD_LOCAL_2D_VECTOR(h_x);
-    REGISTER_THREAD_LOCAL_2D_VECTOR(h_y);
+    ThreadLocal1DVector lambda;
+    ThreadLocal2DVector h_x;
+    ThreadLocal2DVector h_y;
     REGISTER_GLOBAL_1D_VECTOR(g);
 
-    // Vectors for computing the sum of gradients (g).
-    REGISTER_THREAD_LOCAL_2D_VECTOR(g_kappa);
-    REGISTER_THREAD_LOCAL_1D_VECTOR(g_lambda);
-    REGISTER_THREAD_LOCAL_2D_VECTOR(g_h_bar);
-    REGISTER_GLOBAL_1D_VECTOR(n_zeroes);
+    // If lambda doesn't depend on the model (see Model::StaticLambda),
+    // it is computed for every coordinate once, at set up.
+    bool lambda_is_static;
+    REGISTER_GLOBAL_1D_VECTOR(static_lambda);
 
-    void PrepareMu(std::vector<int> &coordinates) override {
-	std::vector<double> &cur_model = model->ModelData();
-	std::vector<double> &lambda = GET_THREAD_LOCAL_VECTOR(lambda);
+    // Coefficients of each datapoint (indexed by order-1) at the snapshot,
+    // if caching them (see Model::HasScalarCoefficients).
+    bool cache_snapshot_coeffs;
+    ModelVector snapshot_coeffs;
+
+    // Data for computing the sum of gradients (g).
+    ThreadLocal<std::vector<double> > g_kappa;
+    ThreadLocal2DVector g_h_bar;
+    ThreadLocal<SparseGradientAccumulator> g_sums;
+
+    void PrepareMu(int thread, DatapointCoordinates &coordinates) override {
+	if (lambda_is_static) return;
+	ModelVector &cur_model = model->ModelData();
+	ModelVector &local_lambda = lambda.Get(thread);
 	for (int i = 0; i < coordinates.size(); i++) {
 	    int index = coordinates[i];
-	    model->Lambda(index, lambda[index], cur_model);
+	    model->Lambda(index, local_lambda[index], cur_model);
 	}
     }
 
-    void PrepareNu(std::vector<int> &coordinates) override {
+    void PrepareNu(int thread, DatapointCoordinates &coordinates) override {
     }
 
-    void PrepareH(Datapoint *datapoint, Gradient *g) override {
-	std::vector<double> &cur_model = model->ModelData();
-	std::vector<std::vector<double> > &h_x = GET_THREAD_LOCAL_VECTOR(h_x);
-	std::vector<std::vector<double> > &h_y = GET_THREAD_LOCAL_VECTOR(h_y);
+    void PrepareH(int thread, Datapoint *datapoint, Gradient *g) override {
+	ModelVector &cur_model = model->ModelData();
+	std::vector<std::vector<double> > &local_h_x = h_x.Get(thread);
+	std::vector<std::vector<double> > &local_h_y = h_y.Get(thread);
 
 	g->datapoint = datapoint;
 	model->PrecomputeCoefficients(datapoint, g, cur_model);
-	int coord_size = model->CoordinateSize();
 	for (int i = 0; i < datapoint->GetCoordinates().size(); i++) {
 	    int index = datapoint->GetCoordinates()[i];
-	    model->H_bar(index, h_x[index], g, cur_model);
+	    model->H_bar(index, local_h_x[index], g, cur_model);
+	}
+	if (cache_snapshot_coeffs) {
+	    model->RestoreCoefficients(datapoint, g, snapshot_coeffs[datapoint->GetOrder()-1]);
+	}
+	else {
+	    model->PrecomputeCoefficients(datapoint, g, model_copy);
 	}
-	model->PrecomputeCoefficients(datapoint, g, model_copy);
 	for (int i = 0; i < datapoint->GetCoordinates().size(); i++) {
 	    int index = datapoint->GetCoordinates()[i];
-	    model->H_bar(index, h_y[index], g, model_copy);
+	    model->H_bar(index, local_h_y[index], g, model_copy);
 	}
     }
 
-    double H(int coordinate, int index_into_coordinate_vector) {
-	return -FLAGS_learning_rate * (GET_THREAD_LOCAL_VECTOR(h_x)[coordinate][index_into_coordinate_vector] -
-				       GET_THREAD_LOCAL_VECTOR(h_y)[coordinate][index_into_coordinate_vector]);
+    double H(int thread, int coordinate, int index_into_coordinate_vector) {
+	return -FLAGS_learning_rate * (h_x.Get(thread)[coordinate][index_into_coordinate_vector] -
+				       h_y.Get(thread)[coordinate][index_into_coordinate_vector]);
     }
 
-    double Nu(int coordinate, int index_into_coordinate_vector) {
+    double Lambda(int thread, int coordinate) {
+	if (lambda_is_static) {
+	    return GET_GLOBAL_VECTOR(static_lambda)[coordinate];
+	}
+	return lambda.Get(thread)[coordinate];
+    }
+
+    double Nu(int thread, int coordinate, int index_into_coordinate_vector) {
 	return FLAGS_learning_rate * (GET_GLOBAL_VECTOR(g)[coordinate*model->CoordinateSize()+index_into_coordinate_vector] -
-				      GET_THREAD_LOCAL_VECTOR(lambda)[coordinate] * model_copy[coordinate*model->CoordinateSize()+index_into_coordinate_vector]);
+				      Lambda(thread, coordinate) * model_copy[coordinate*row_stride+index_into_coordinate_vector]);
+    }
+
+    double Mu(int thread, int coordinate) {
+	return Lambda(thread, coordinate) * FLAGS_learning_rate;
     }
 
-    double Mu(int coordinate) {
-	return GET_THREAD_LOCAL_VECTOR(lambda)[coordinate] * FLAGS_learning_rate;
+    // Sum the per-thread accumulators into thread 0's, by merging pairs of
+    // accumulators in parallel in log(n_threads) rounds.
+    void ReduceGradientSums() {
+	for (int stride = 1; stride < FLAGS_n_threads; stride *= 2) {
+#pragma omp parallel for num_threads(FLAGS_n_threads)
+	    for (int thread = 0; thread < FLAGS_n_threads; thread += 2 * stride) {
+		if (thread + stride < FLAGS_n_threads) {
+		    g_sums.Get(thread).MergeFrom(g_sums.Get(thread + stride));
+		}
+	    }
+	}
     }
 
     void ModelCopy() {
 
-	// Make a copy of the model every epoch.
+	// Make a copy of the model.
 	model_copy = model->ModelData();
 
-	// Clear the sum of gradients.
-	std::vector<double> &g = GET_GLOBAL_VECTOR(g);
-	std::fill(g.begin(), g.end(), 0);
-
-	// Compute average sum of gradients on the model copy.
-	std::vector<double> &n_zeroes = GET_GLOBAL_VECTOR(n_zeroes);
 	int coord_size = model->CoordinateSize();
+	double n_datapoints = datapoints.size();
 
-	// zero gradients.
-#pragma omp parallel for num_threads(FLAGS_n_threads)
-	for (int coordinate = 0; coordinate < model->NumParameters(); coordinate++) {
-	    std::vector<std::vector<double> > &g_kappa = GET_THREAD_LOCAL_VECTOR(g_kappa);
-	    std::vector<double> &g_lambda = GET_THREAD_LOCAL_VECTOR(g_lambda);
-	    model->Kappa(coordinate, g_kappa[coordinate], model_copy);
-	    model->Lambda(coordinate, g_lambda[coordinate], model_copy);
-	    for (int j = 0; j < coord_size; j++) {
-		g[coordinate*coord_size+j] = (g_lambda[coordinate] * model_copy[coordinate*coord_size+j] - g_kappa[coordinate][j]) * n_zeroes[coordinate];
-	    }
-	}
-
-	// non zero gradients. Essentially do SGD here, on the same partitioning pattern.
+	// Sum h_bar over all datapoints on the model copy. Each thread sums
+	// the datapoints of its partition into its own accumulator.
 #pragma omp parallel num_threads(FLAGS_n_threads)
 	{
 	    int thread = omp_get_thread_num();
+	    Gradient *grad = &thread_gradients.Get(thread);
+	    std::vector<std::vector<double> > &local_g_h_bar = g_h_bar.Get(thread);
+	    SparseGradientAccumulator &local_g_sums = g_sums.Get(thread);
 	    for (int batch = 0; batch < datapoint_partitions->NumBatches(); batch++) {
-#pragma omp barrier
-		for (int index = 0; index < datapoint_partitions->NumDatapointsInBatch(thread, batch); index++) {
+		for (DatapointIndex index = 0; index < datapoint_partitions->NumDatapointsInBatch(thread, batch); index++) {
 		    Datapoint *datapoint = datapoint_partitions->GetDatapoint(thread, batch, index);
-		    Gradient *grad = &thread_gradients[omp_get_thread_num()];
 		    grad->datapoint = datapoint;
 		    model->PrecomputeCoefficients(datapoint, grad, model_copy);
-		    std::vector<std::vector<double> > &g_kappa = GET_THREAD_LOCAL_VECTOR(g_kappa);
-		    std::vector<double> &g_lambda = GET_THREAD_LOCAL_VECTOR(g_lambda);
-		    std::vector<std::vector<double> > &g_h_bar = GET_THREAD_LOCAL_VECTOR(g_h_bar);
-		    for (auto & coord : datapoint->GetCoordinates()) {
-			model->H_bar(coord, g_h_bar[coord], grad, model_copy);
-			model->Lambda(coord, g_lambda[coord], model_copy);
-			model->Kappa(coord, g_kappa[coord], model_copy);
+		    if (cache_snapshot_coeffs) {
+			snapshot_coeffs[datapoint->GetOrder()-1] = grad->scalar_coeff;
 		    }
 		    for (auto & coord : datapoint->GetCoordinates()) {
+			model->H_bar(coord, local_g_h_bar[coord], grad, model_copy);
+			double *row = local_g_sums.Row(coord);
 			for (int j = 0; j < coord_size; j++) {
-			    g[coord*coord_size+j] += g_lambda[coord] * model_copy[coord*coord_size+j]
-				- g_kappa[coord][j] + g_h_bar[coord][j];
+			    row[j] += local_g_h_bar[coord][j];
 			}
 		    }
 		}
 	    }
 	}
+	ReduceGradientSums();
 
-#pragma omp parallel for num_threads(FLAGS_n_threads)
-	for (int i = 0; i < model->NumParameters(); i++) {
-	    for (int j = 0; j < coord_size; j++) {
-		g[i*coord_size+j] /= datapoints.size();
+	// The λx - κ part of the gradient is the same at every datapoint, so
+	// g = (n * (λx - κ) + sum of h_bar) / n, with λ and κ computed once
+	// per coordinate.
+	ModelVector &g = GET_GLOBAL_VECTOR(g);
+	SparseGradientAccumulator &sums = g_sums.Get(0);
+#pragma omp parallel num_threads(FLAGS_n_threads)
+	{
+	    std::vector<double> &local_g_kappa = g_kappa.Get(omp_get_thread_num());
+#pragma omp for
+	    for (int coordinate = 0; coordinate < model->NumParameters(); coordinate++) {
+		double g_lambda = 0;
+		model->Lambda(coordinate, g_lambda, model_copy);
+		model->Kappa(coordinate, local_g_kappa, model_copy);
+		for (int j = 0; j < coord_size; j++) {
+		    g[coordinate*coord_size+j] = g_lambda * model_copy[coordinate*row_stride+j] - local_g_kappa[j]
+			+ sums.Value(coordinate, j) / n_datapoints;
+		}
 	    }
 	}
+	sums.Clear();
+
+	n_epochs_since_snapshot = 0;
+    }
+
+    bool SnapshotDue() {
+	return n_epochs_since_snapshot >= FLAGS_svrg_snapshot_interval_epochs;
     }
 
  public:
  SVRGUpdater(Model *model, std::vector<Datapoint *> &datapoints) : Updater(model, datapoints) {
+	std::vector<double> zero_coordinate(model->CoordinateSize(), 0);
 	INITIALIZE_GLOBAL_1D_VECTOR(g, model->NumParameters() * model->CoordinateSize());
-	INITIALIZE_THREAD_LOCAL_1D_VECTOR(lambda, model->NumParameters());
-	INITIALIZE_THREAD_LOCAL_2D_VECTOR(h_x, model->NumParameters(), model->CoordinateSize());
-	INITIALIZE_THREAD_LOCAL_2D_VECTOR(h_y, model->NumParameters(), model->CoordinateSize());
-	model_copy.resize(model->ModelData().size());
-	INITIALIZE_THREAD_LOCAL_2D_VECTOR(g_kappa, model->NumParameters(), model->CoordinateSize());
-	INITIALIZE_THREAD_LOCAL_1D_VECTOR(g_lambda, model->NumParameters());
-	INITIALIZE_THREAD_LOCAL_2D_VECTOR(g_h_bar, model->NumParameters(), model->CoordinateSize());
-
-	// Compute number of zeroes for each column (parameters) of the model.
-	INITIALIZE_GLOBAL_1D_VECTOR(n_zeroes, model->NumParameters());
-	std::vector<double> &n_zeroes = GET_GLOBAL_VECTOR(n_zeroes);
-	for (int i = 0; i < model->NumParameters(); i++) {
-	    n_zeroes[i] = datapoints.size();
-	}
-	int sum = 0;
-	for (int dp = 0; dp < datapoints.size(); dp++) {
-	    for (auto &coordinate : datapoints[dp]->GetCoordinates()) {
-		n_zeroes[coordinate]--;
-		sum++;
+	lambda_is_static = model->StaticLambda();
+	if (lambda_is_static) {
+	    INITIALIZE_GLOBAL_1D_VECTOR(static_lambda, model->NumParameters());
+	    ModelVector &static_lambda = GET_GLOBAL_VECTOR(static_lambda);
+	    for (int i = 0; i < model->NumParameters(); i++) {
+		model->Lambda(i, static_lambda[i], model->ModelData());
 	    }
+
+	    // Same mu everywhere, so catch up can be tabulated.
+	    if (model->UniformLambda() && model->NumParameters() > 0) {
+		catch_up_table.Initialize(static_lambda[0] * FLAGS_learning_rate, MaxStaleness());
+	    }
+	}
+	else {
+	    lambda.Initialize(FLAGS_n_threads, model->NumParameters(), 0.0);
 	}
+	h_x.Initialize(FLAGS_n_threads, model->NumParameters(), zero_coordinate);
+	h_y.Initialize(FLAGS_n_threads, model->NumParameters(), zero_coordinate);
+	model_copy.resize(model->ModelData().size());
+	g_kappa.Initialize(FLAGS_n_threads, model->CoordinateSize(), 0.0);
+	g_h_bar.Initialize(FLAGS_n_threads, model->NumParameters(), zero_coordinate);
+	g_sums.Initialize(FLAGS_n_threads, model->NumParameters(), model->CoordinateSize());
+
+	cache_snapshot_coeffs = FLAGS_svrg_cache_snapshot_coefficients && model->HasScalarCoefficients();
+	if (cache_snapshot_coeffs) {
+	    snapshot_coeffs.resize(datapoints.size());
+	}
+
+	// Take the first snapshot at the beginning of the first epoch.
+	n_epochs_since_snapshot = INT_MAX;
     }
 
     void Update(Model *model, Datapoint *datapoint) override {
@@ -176,7 +281,14 @@ protected:
 
     void EpochBegin() override {
 	Updater::EpochBegin();
-	ModelCopy();
+	if (SnapshotDue()) {
+	    ModelCopy();
+	}
+    }
+
+    void EpochFinish() override {
+	Updater::EpochFinish();
+	n_epochs_since_snapshot++;
     }
 
     ~SVRGUpdater() {
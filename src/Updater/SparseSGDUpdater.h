@@ -22,50 +22,56 @@
 
 class SparseSGDUpdater : public Updater {
 protected:
-    REGISTER_THREAD_LOCAL_2D_VECTOR(h_bar);
+    ThreadLocal2DVector h_bar;
 
     // Catch up is not required as mu and nu are 0.
     virtual bool NeedCatchUp() {
 	return false;
     }
 
-    void PrepareNu(std::vector<int> &coordinates) override {
+    void PrepareNu(int thread, DatapointCoordinates &coordinates) override {
 	// Nu is 0.
     }
 
-    void PrepareMu(std::vector<int> &coordinates) override {
+    void PrepareMu(int thread, DatapointCoordinates &coordinates) override {
 	// Mu is 0.
     }
 
-    void PrepareH(Datapoint *datapoint, Gradient *g) override {
-	std::vector<double> &cur_model = model->ModelData();
-	std::vector<std::vector<double> > &h_bar = GET_THREAD_LOCAL_VECTOR(h_bar);
+    void PrepareH(int thread, Datapoint *datapoint, Gradient *g) override {
+	ModelVector &cur_model = ModelData(thread);
+	std::vector<std::vector<double> > &local_h_bar = h_bar.Get(thread);
 	model->PrecomputeCoefficients(datapoint, g, cur_model);
 	for (int i = 0; i < datapoint->GetCoordinates().size(); i++) {
 	    int index = datapoint->GetCoordinates()[i];
-	    model->H_bar(index, h_bar[index], g, cur_model);
+	    model->H_bar(index, local_h_bar[index], g, cur_model);
 	}
     }
 
-    double H(int coordinate, int index_into_coordinate_vector) {
-	return -GET_THREAD_LOCAL_VECTOR(h_bar)[coordinate][index_into_coordinate_vector] * FLAGS_learning_rate;
+    double H(int thread, int coordinate, int index_into_coordinate_vector) {
+	return -h_bar.Get(thread)[coordinate][index_into_coordinate_vector] * FLAGS_learning_rate;
     }
 
-    double Nu(int coordinate, int index_into_coordinate_vector) {
+    double Nu(int thread, int coordinate, int index_into_coordinate_vector) {
 	return 0;
     }
 
-    double Mu(int coordinate) {
+    double Mu(int thread, int coordinate) {
 	return 0;
     }
 
  public:
     SparseSGDUpdater(Model *model, std::vector<Datapoint *> &datapoints) : Updater(model, datapoints) {
-	INITIALIZE_THREAD_LOCAL_2D_VECTOR(h_bar, model->NumParameters(), model->CoordinateSize());
+	h_bar.Initialize(FLAGS_n_threads, model->NumParameters(), std::vector<double>(model->CoordinateSize(), 0));
     }
 
     ~SparseSGDUpdater() {
     }
+
+    // Without catch up, the model is only written in ApplyGradient (and in
+    // the update paths of subclasses, which handle hubs too).
+    bool CanUpdateHubsAtomically() override {
+	return true;
+    }
 };
 
 #endif
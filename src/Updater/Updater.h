@@ -19,19 +19,15 @@
 
 #include "../DatapointPartitions/DatapointPartitions.h"
 #include "../Gradient/Gradient.h"
+#include "../Precision/Precision.h"
+#include "../ThreadLocal/ThreadLocal.h"
+#include "CatchUpTable.h"
 
-// Some macros to declare extra thread-local / global 1d/2d vectors.
+// Some macros to declare extra global 1d/2d vectors.
+// Per-thread vectors should use ThreadLocal (see ThreadLocal/ThreadLocal.h).
 // This avoids the use of std::maps, which are very inefficient.
 // Gives around a 2-3x speedup over using maps.
-#define REGISTER_THREAD_LOCAL_1D_VECTOR(NAME) std::vector<std::vector<double> > NAME ## _LOCAL_
-#define REGISTER_THREAD_LOCAL_2D_VECTOR(NAME) std::vector<std::vector<std::vector<double> > > NAME ## _LOCAL_
-
-#define INITIALIZE_THREAD_LOCAL_1D_VECTOR(NAME, N_COLUMNS) {NAME##_LOCAL_.resize(FLAGS_n_threads); for (int i = 0; i < FLAGS_n_threads; i++) NAME ## _LOCAL_[i].resize(N_COLUMNS, 0);}
-#define INITIALIZE_THREAD_LOCAL_2D_VECTOR(NAME, N_ROWS, N_COLUMNS) {NAME##_LOCAL_.resize(FLAGS_n_threads); for (int i = 0; i < FLAGS_n_threads; i++) NAME ## _LOCAL_[i].resize(N_ROWS, std::vector<double>(N_COLUMNS, 0));}
-
-#define GET_THREAD_LOCAL_VECTOR(NAME) NAME ## _LOCAL_[omp_get_thread_num()]
-
-#define REGISTER_GLOBAL_1D_VECTOR(NAME) std::vector<double> NAME ## _GLOBAL_
+#define REGISTER_GLOBAL_1D_VECTOR(NAME) ModelVector NAME ## _GLOBAL_
 #define REGISTER_GLOBAL_2D_VECTOR(NAME) std::vector<std::vector<double> > NAME ## _GLOBAL_
 
 #define INITIALIZE_GLOBAL_1D_VECTOR(NAME, N_COLUMNS) {NAME ## _GLOBAL_.resize(N_COLUMNS, 0);}
@@ -39,8 +35,9 @@
 
 #define GET_GLOBAL_VECTOR(NAME) NAME ## _GLOBAL_
 
-#define REGISTER_THREAD_LOCAL_DOUBLE(NAME) std::vector<double > NAME ## _LOCAL_
-#define INITIALIZE_THREAD_LOCAL_DOUBLE(NAME) {NAME##_LOCAL_.resize(FLAGS_n_threads); std::fill(NAME##_LOCAL_.begin(), NAME##_LOCAL_.end(), 0);}
+// Per-thread 1d/2d vectors of doubles.
+typedef ThreadLocal<ModelVector> ThreadLocal1DVector;
+typedef ThreadLocal<std::vector<std::vector<double> > > ThreadLocal2DVector;
 
 class Updater {
 protected:
@@ -49,80 +46,216 @@ protected:
     std::vector<Datapoint *> datapoints;
     DatapointPartitions *datapoint_partitions;
 
-    // Have an array of Gradient objects (stores extra info for Model processing).
+    // Have a Gradient object per thread (stores extra info for Model processing).
     // Have 1 per thread to avoid conflicts.
-    Gradient *thread_gradients;
-    std::vector<int> bookkeeping;
+    ThreadLocal<Gradient> thread_gradients;
+
+    // Order of the last update to touch each coordinate. If the model has
+    // row stamps (see Model::HasRowStamps) it is kept next to the
+    // coordinate's row, so that catching up and stamping a coordinate touch
+    // the cache line the update touches anyway; else in bookkeeping.
+    // Use LastTouch / Touch rather than accessing either directly.
+    std::vector<DatapointIndex> bookkeeping;
+    bool row_stamps;
+
+    // Doubles between consecutive coordinates of the model (see Model::RowStride).
+    int row_stride;
 
     // A reference to all_coordinates, which indexes all the coordinates of the model.
     std::vector<int> all_coordinates;
 
-    // H, Nu and Mu for updates.
-    virtual double H(int coordinate, int index_into_coordinate_vector) = 0;
-    virtual double Nu(int coordinate, int index_into_coordinate_vector) = 0;
-    virtual double Mu(int coordinate) = 0;
+    // Per-thread state of gather-compute-scatter execution (see UpdateGathered).
+    struct GatheredRows {
+	bool active = false;
+	// Position in rows of each coordinate of the model, -1 if not gathered.
+	std::vector<int> local_index;
+	// Coordinate of each gathered row.
+	std::vector<int> coordinates;
+	// The gathered rows, contiguous and RowStride() apart.
+	ModelVector rows;
+    };
+    ThreadLocal<GatheredRows> gathered_rows;
+
+    // Model data the updates of a thread act on: its gathered rows within
+    // UpdateGathered, the model otherwise.
+    inline ModelVector & ModelData(int thread) {
+	GatheredRows &gathered = gathered_rows.Get(thread);
+	return gathered.active ? gathered.rows : model->ModelData();
+    }
+
+    // Whether each coordinate is a hub (see SetHubCoordinates). Empty if
+    // there are none.
+    std::vector<char> hubs;
+
+    inline bool IsHub(int coordinate) {
+	return !hubs.empty() && hubs[coordinate];
+    }
+
+    // Closed form catch up coefficients. Set up by updaters whose mu is
+    // the same for every coordinate and update (see CatchUpTable).
+    CatchUpTable catch_up_table;
+
+    // H, Nu and Mu for updates. thread is the index of the calling
+    // thread, resolved once per update by the caller.
+    virtual double H(int thread, int coordinate, int index_into_coordinate_vector) = 0;
+    virtual double Nu(int thread, int coordinate, int index_into_coordinate_vector) = 0;
+    virtual double Mu(int thread, int coordinate) = 0;
 
     // After calling PrepareNu/Mu/H, for the given coordinates, we expect that
     // calls to Nu/Mu/H are ready.
-    virtual void PrepareNu(std::vector<int> &coordinates) = 0;
-    virtual void PrepareMu(std::vector<int> &coordinates) = 0;
-    virtual void PrepareH(Datapoint *datapoint, Gradient *g) = 0;
+    virtual void PrepareNu(int thread, DatapointCoordinates &coordinates) = 0;
+    virtual void PrepareMu(int thread, DatapointCoordinates &coordinates) = 0;
+    virtual void PrepareH(int thread, Datapoint *datapoint, Gradient *g) = 0;
 
-    // By default need catch up.
+    // By default need catch up. Updaters that don't (e.g: SparseSGDUpdater)
+    // also skip bookkeeping entirely.
     virtual bool NeedCatchUp() {
 	return true;
     }
 
-    virtual void ApplyGradient(Datapoint *datapoint) {
-	std::vector<double> &model_data = model->ModelData();
+    inline DatapointIndex LastTouch(ModelVector &model_data, int coordinate) {
+	if (row_stamps) {
+	    return model_data[coordinate * row_stride + row_stride - 1];
+	}
+	return bookkeeping[coordinate];
+    }
+
+    inline void Touch(ModelVector &model_data, int coordinate, DatapointIndex order) {
+	if (row_stamps) {
+	    model_data[coordinate * row_stride + row_stride - 1] = order;
+	}
+	else {
+	    bookkeeping[coordinate] = order;
+	}
+    }
+
+    // Atomically move the last touch of coordinate forward to order, unless
+    // it already is there or later. Returns the last touch before, so that of
+    // threads touching a coordinate at once, only one claims any interval of
+    // updates to catch up over.
+    DatapointIndex AdvanceTouch(ModelVector &model_data, int coordinate, DatapointIndex order) {
+	DatapointIndex last = LastTouch(model_data, coordinate);
+	while (last < order) {
+	    DatapointIndex seen;
+	    if (row_stamps) {
+		// The stamp is a double in the row: swap its bits.
+		uint64_t *stamp = reinterpret_cast<uint64_t *>(&model_data[coordinate * row_stride + row_stride - 1]);
+		double expected = last, desired = order, seen_value;
+		uint64_t expected_bits, desired_bits;
+		memcpy(&expected_bits, &expected, sizeof(expected));
+		memcpy(&desired_bits, &desired, sizeof(desired));
+		uint64_t seen_bits = __sync_val_compare_and_swap(stamp, expected_bits, desired_bits);
+		memcpy(&seen_value, &seen_bits, sizeof(seen_value));
+		seen = seen_value;
+	    }
+	    else {
+		seen = __sync_val_compare_and_swap(&bookkeeping[coordinate], last, order);
+	    }
+	    if (seen == last) break;
+	    last = seen;
+	}
+	return last;
+    }
+
+    void ClearBookkeeping() {
+	if (row_stamps) {
+	    ModelVector &model_data = model->ModelData();
+	    for (int i = 0; i < model->NumParameters(); i++) {
+		model_data[i * row_stride + row_stride - 1] = 0;
+	    }
+	}
+	else {
+	    std::fill(bookkeeping.begin(), bookkeeping.end(), 0);
+	}
+    }
+
+    virtual void ApplyGradient(int thread, Datapoint *datapoint) {
+	ModelVector &model_data = ModelData(thread);
 	int coordinate_size = model->CoordinateSize();
 	for (int i = 0; i < datapoint->GetCoordinates().size(); i++) {
 	    int index = datapoint->GetCoordinates()[i];
-	    double mu = Mu(index);
+	    double mu = Mu(thread, index);
+	    if (IsHub(index)) {
+		for (int j = 0; j < coordinate_size; j++) {
+		    double value = model_data[index * row_stride + j];
+		    AtomicAdd(&model_data[index * row_stride + j], -mu * value - Nu(thread, index, j) + H(thread, index, j));
+		}
+		continue;
+	    }
 	    for (int j = 0; j < coordinate_size; j++) {
-		model_data[index * coordinate_size + j] = (1 - mu) * model_data[index * coordinate_size + j]
-		    - Nu(index, j)
-		    + H(index, j);
+		model_data[index * row_stride + j] = (1 - mu) * model_data[index * row_stride + j]
+		    - Nu(thread, index, j)
+		    + H(thread, index, j);
 	    }
 	}
     }
 
-    virtual void CatchUp(int index, int diff) {
+    // Largest diff CatchUp can be called with (the catch up table covers at
+    // most FLAGS_catch_up_table_size of them).
+    DatapointIndex MaxStaleness() {
+	return datapoints.size();
+    }
+
+    virtual void CatchUp(int thread, int index, DatapointIndex diff) {
 	if (!NeedCatchUp()) return;
 	if (diff < 0) diff = 0;
-	double geom_sum = 0;
-	double mu = Mu(index);
-	if (mu != 0) {
-	    geom_sum = ((1 - pow(1 - mu, diff+1)) / (1 - (1 - mu))) - 1;
+	ModelVector &model_data = model->ModelData();
+	int coordinate_size = model->CoordinateSize();
+	double decay, geom_sum;
+	if (catch_up_table.Enabled() && catch_up_table.Covers(diff)) {
+	    decay = catch_up_table.Decay(diff);
+	    geom_sum = catch_up_table.GeomSum(diff);
 	}
-	for (int j = 0; j < model->CoordinateSize(); j++) {
-	    model->ModelData()[index * model->CoordinateSize() + j] =
-		pow(1 - mu, diff) * model->ModelData()[index * model->CoordinateSize() + j]
-		- Nu(index, j) * geom_sum;
+	else {
+	    double mu = Mu(thread, index);
+	    geom_sum = 0;
+	    decay = 1;
+	    if (mu != 0) {
+		decay = pow(1 - mu, diff);
+		geom_sum = ((1 - decay * (1 - mu)) / (1 - (1 - mu))) - 1;
+	    }
+	}
+	for (int j = 0; j < coordinate_size; j++) {
+	    model_data[index * row_stride + j] =
+		decay * model_data[index * row_stride + j]
+		- Nu(thread, index, j) * geom_sum;
 	}
     }
 
-    virtual void CatchUpDatapoint(Datapoint *datapoint) {
-	std::vector<double> &model_data = model->ModelData();
-	int coordinate_size = model->CoordinateSize();
+    virtual void CatchUpDatapoint(int thread, Datapoint *datapoint) {
+	if (!NeedCatchUp()) return;
+	ModelVector &model_data = model->ModelData();
 	for (int i = 0; i < datapoint->GetCoordinates().size(); i++) {
 	    int index = datapoint->GetCoordinates()[i];
-	    int diff = datapoint->GetOrder() - bookkeeping[index] - 1;
-	    CatchUp(index, diff);
+	    DatapointIndex diff = datapoint->GetOrder() - LastTouch(model_data, index) - 1;
+	    CatchUp(thread, index, diff);
 	}
     }
 
+    // Catch every coordinate up to the end of the epoch. Each thread only
+    // prepares and catches up its own share of the coordinates, skipping
+    // those that were touched by the last update of the epoch.
     virtual void FinalCatchUp() {
-	int coordinate_size = model->CoordinateSize();
-	std::vector<double> &model_data = model->ModelData();
+	if (!NeedCatchUp()) return;
+	DatapointIndex n_updates = datapoints.size();
+	int n_coordinates = model->NumParameters();
+	ModelVector &model_data = model->ModelData();
 #pragma omp parallel num_threads(FLAGS_n_threads)
 	{
-	    PrepareNu(all_coordinates);
-	    PrepareMu(all_coordinates);
-#pragma omp for
-	    for (int i = 0; i < model->NumParameters(); i++) {
-		int diff = model->NumParameters() - bookkeeping[i];
-		CatchUp(i, diff);
+	    int thread = omp_get_thread_num();
+	    int n_threads = omp_get_num_threads();
+	    int start = (long long)n_coordinates * thread / n_threads;
+	    int end = (long long)n_coordinates * (thread+1) / n_threads;
+	    DatapointCoordinates stale_coordinates;
+	    for (int i = start; i < end; i++) {
+		if (LastTouch(model_data, i) != n_updates) {
+		    stale_coordinates.push_back(i);
+		}
+	    }
+	    PrepareNu(thread, stale_coordinates);
+	    PrepareMu(thread, stale_coordinates);
+	    for (const auto &coordinate : stale_coordinates) {
+		CatchUp(thread, coordinate, n_updates - LastTouch(model_data, coordinate));
 	    }
 	}
     }
@@ -130,16 +263,16 @@ protected:
 public:
     Updater(Model *model, std::vector<Datapoint *> &datapoints) {
 	// Create gradients for each thread.
-	thread_gradients = new Gradient[FLAGS_n_threads];
-	for (int thread = 0; thread < FLAGS_n_threads; thread++) {
-	    thread_gradients[thread] = Gradient();
-	}
+	thread_gradients.Initialize(FLAGS_n_threads);
+	gathered_rows.Initialize(FLAGS_n_threads);
 	this->model = model;
 
 	// Set up bookkeping.
 	this->datapoints = datapoints;
-	for (int i = 0; i < model->NumParameters(); i++) {
-	    bookkeeping.push_back(0);
+	row_stride = model->RowStride();
+	row_stamps = model->HasRowStamps();
+	if (!row_stamps) {
+	    bookkeeping.resize(model->NumParameters(), 0);
 	}
 
 	// Keep an array that has integers 1...n_coords.
@@ -150,7 +283,6 @@ public:
 
     Updater() {}
     virtual ~Updater() {
-	delete [] thread_gradients;
     }
 
     // Could be useful to get partitioning info.
@@ -160,22 +292,136 @@ public:
 
     // Main update method, which is run by multiple threads.
     virtual void Update(Model *model, Datapoint *datapoint) {
-	int thread_num = omp_get_thread_num();
-	thread_gradients[thread_num].Clear();
-	thread_gradients[thread_num].datapoint = datapoint;
+	int thread = omp_get_thread_num();
+	Gradient &gradient = thread_gradients.Get(thread);
+	gradient.Clear();
+	gradient.datapoint = datapoint;
 
 	// First prepare Nu and Mu for catchup since they are independent of the the model.
-	PrepareNu(datapoint->GetCoordinates());
-	PrepareMu(datapoint->GetCoordinates());
-        CatchUpDatapoint(datapoint);
+	PrepareNu(thread, datapoint->GetCoordinates());
+	PrepareMu(thread, datapoint->GetCoordinates());
+	CatchUpDatapoint(thread, datapoint);
 
 	// After catching up, prepare H and apply the gradient.
-	PrepareH(datapoint, &thread_gradients[thread_num]);
-	ApplyGradient(datapoint);
+	PrepareH(thread, datapoint, &gradient);
+	ApplyGradient(thread, datapoint);
 
 	// Update bookkeeping.
-	for (const auto &coordinate : datapoint->GetCoordinates()) {
-	    bookkeeping[coordinate] = datapoint->GetOrder();
+	if (NeedCatchUp()) {
+	    ModelVector &model_data = model->ModelData();
+	    for (const auto &coordinate : datapoint->GetCoordinates()) {
+		Touch(model_data, coordinate, datapoint->GetOrder());
+	    }
+	}
+    }
+
+    // The model data updates act on outside of UpdateGathered, with the
+    // distance in bytes between its rows (e.g: to prefetch rows). Updaters
+    // that train on another copy of the model (e.g: in reduced precision)
+    // return that copy.
+    virtual const char *UpdateData(size_t &row_bytes) {
+	row_bytes = row_stride * sizeof(double);
+	return (const char *)model->ModelData().data();
+    }
+
+    // Whether UpdateGathered can run updates against gathered rows. Only if
+    // all state an update touches, other than the model rows of its
+    // datapoint, is thread local: catch up (bookkeeping) rules that out.
+    virtual bool CanGatherUpdates() {
+	return !NeedCatchUp();
+    }
+
+    // Whether the updater applies the updates of hub coordinates atomically
+    // (see SetHubCoordinates). Catch up and bookkeeping can't be.
+    virtual bool CanUpdateHubsAtomically() {
+	return false;
+    }
+
+    // Set the hub coordinates: coordinates so widely shared that they are
+    // left out of the conflict graph (see CycladesPartitioner), so that
+    // updates of datapoints run by different threads at once touch them.
+    // Their updates are applied as atomic adds, so none are lost.
+    void SetHubCoordinates(const std::vector<int> &hub_coordinates) {
+	hubs.clear();
+	if (hub_coordinates.empty()) return;
+	if (!CanUpdateHubsAtomically()) {
+	    std::cerr << "Updater: This updater can't update hub coordinates atomically." << std::endl;
+	    exit(0);
+	}
+	hubs.resize(model->NumParameters(), 0);
+	for (const auto &coordinate : hub_coordinates) {
+	    hubs[coordinate] = 1;
+	}
+    }
+
+    // Gather-compute-scatter execution of the updates of n datapoints, whose
+    // coordinates no other thread touches meanwhile (e.g: a cyclades
+    // component): the model rows they touch are copied into a contiguous
+    // thread local buffer, all updates run against it, and the rows are
+    // then written back. Meanwhile the datapoints' coordinates are relabeled
+    // to index into the buffer.
+    void UpdateGathered(Model *model, Datapoint **datapoints, int n) {
+	if (!CanGatherUpdates()) {
+	    for (int i = 0; i < n; i++) {
+		Update(model, datapoints[i]);
+	    }
+	    return;
+	}
+	GatheredRows &gathered = gathered_rows.Get(omp_get_thread_num());
+	ModelVector &model_data = this->model->ModelData();
+	if (gathered.local_index.empty()) {
+	    gathered.local_index.resize(this->model->NumParameters(), -1);
+	}
+
+	// Relabel coordinates and gather their rows.
+	gathered.coordinates.clear();
+	for (int i = 0; i < n; i++) {
+	    for (auto &coordinate : datapoints[i]->GetCoordinates()) {
+		if (gathered.local_index[coordinate] < 0) {
+		    gathered.local_index[coordinate] = gathered.coordinates.size();
+		    gathered.coordinates.push_back(coordinate);
+		}
+		coordinate = gathered.local_index[coordinate];
+	    }
+	}
+	gathered.rows.resize(gathered.coordinates.size() * row_stride);
+	for (int i = 0; i < gathered.coordinates.size(); i++) {
+	    std::copy(&model_data[gathered.coordinates[i] * row_stride],
+		      &model_data[gathered.coordinates[i] * row_stride] + row_stride,
+		      &gathered.rows[i * row_stride]);
+	}
+
+	gathered.active = true;
+	for (int i = 0; i < n; i++) {
+	    Update(model, datapoints[i]);
+	}
+	gathered.active = false;
+
+	// Scatter the rows back and restore coordinates.
+	for (int i = 0; i < gathered.coordinates.size(); i++) {
+	    std::copy(&gathered.rows[i * row_stride],
+		      &gathered.rows[i * row_stride] + row_stride,
+		      &model_data[gathered.coordinates[i] * row_stride]);
+	    gathered.local_index[gathered.coordinates[i]] = -1;
+	}
+	for (int i = 0; i < n; i++) {
+	    for (auto &coordinate : datapoints[i]->GetCoordinates()) {
+		coordinate = gathered.coordinates[coordinate];
+	    }
+	}
+    }
+
+    // Number of datapoints no two of which share a coordinate (e.g: from
+    // different cyclades components) the updater would like to be given at
+    // once, through UpdateIndependent.
+    virtual int IndependentBatchWidth() {
+	return 1;
+    }
+
+    // Update n datapoints, no two of which share a coordinate.
+    virtual void UpdateIndependent(Model *model, Datapoint **datapoints, int n) {
+	for (int i = 0; i < n; i++) {
+	    Update(model, datapoints[i]);
 	}
     }
 
@@ -185,8 +431,15 @@ public:
 
     // Called when the epoch ends.
     virtual void EpochFinish() {
+	if (!NeedCatchUp()) return;
 	FinalCatchUp();
-	std::fill(bookkeeping.begin(), bookkeeping.end(), 0);
+	ClearBookkeeping();
+    }
+
+    // Called before the model is read outside of updates (loss computation,
+    // after training). Updaters that train on another copy of the model
+    // (see UpdateData) store it back.
+    virtual void SyncModel() {
     }
 };
 
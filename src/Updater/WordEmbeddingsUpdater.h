@@ -17,77 +17,147 @@
 #ifndef _WORDEMBEDDINGSUPDATER_
 #define _WORDEMBEDDINGSUPDATER_
 
+#include <type_traits>
 #include "Updater.h"
 #include "../Gradient/Gradient.h"
+#include "../Precision/Precision.h"
 
-// Fast matrix completion SGD updater.
+// Word embeddings SGD updater, which also optimizes C.
+// Trains on the model in Storage precision (see FastMCSGDUpdater).
+template <class Storage = double>
 class WordEmbeddingsSGDUpdater : public SparseSGDUpdater {
 protected:
+    typedef typename ComputeType<Storage>::type Real;
 
-    std::vector<double> c_sum_mult1, c_sum_mult2;
+    ThreadLocal<double> c_sum_mult1, c_sum_mult2;
 
-    void PrepareWordEmbeddingsGradient(Datapoint *datapoint, Gradient *g) {
+    ReducedPrecisionModel<Storage> reduced_model;
+
+    inline Storage * Parameters(int thread) {
+	if (std::is_same<Storage, double>::value) {
+	    return reinterpret_cast<Storage *>(ModelData(thread).data());
+	}
+	return reduced_model.Data();
+    }
+
+    // Stride, in Storage values, of the rows of Parameters().
+    inline int ParametersStride() {
+	if (std::is_same<Storage, double>::value) {
+	    return row_stride;
+	}
+	return reduced_model.RowStride();
+    }
+
+    void PrepareWordEmbeddingsGradient(int thread, Datapoint *datapoint, Gradient *g) {
 	if (g->coeffs.size() != 1) g->coeffs.resize(1);
-	const std::vector<double> &labels = datapoint->GetWeights();
-	const std::vector<int> &coordinates = datapoint->GetCoordinates();
+	const DatapointWeights &labels = datapoint->GetWeights();
+	const DatapointCoordinates &coordinates = datapoint->GetCoordinates();
 	int w2v_length = model->CoordinateSize();
-	std::vector<double> &local_model = model->ModelData();
-	std::vector<double> &C = model->ExtraData();
+	Storage *local_model = Parameters(thread);
+	int stride = ParametersStride();
+	ModelVector &C = model->ExtraData();
 	int coord1 = coordinates[0];
 	int coord2 = coordinates[1];
 	double weight = labels[0];
-	double norm = 0;
+	Real norm = 0;
 	for (int i = 0; i < w2v_length; i++) {
-	    norm += (local_model[coord1*w2v_length+i] + local_model[coord2*w2v_length+i]) *
-		(local_model[coord1*w2v_length+i] + local_model[coord2*w2v_length+i]);
+	    Real sum = (Real)local_model[coord1*stride+i] + (Real)local_model[coord2*stride+i];
+	    norm += sum * sum;
 	}
 	g->coeffs[0] = 2 * weight * (log(weight) - norm - C[0]);
 
 	// Do some extra computation for optimization of C.
-	c_sum_mult1[omp_get_thread_num()] += weight * (log(weight) - norm);
-	c_sum_mult2[omp_get_thread_num()] += weight;
+	c_sum_mult1.Get(thread) += weight * (log(weight) - norm);
+	c_sum_mult2.Get(thread) += weight;
     }
 
-    void ApplyWordEmbeddingsGradient(Datapoint *datapoint, Gradient *g) {
+    void ApplyWordEmbeddingsGradient(int thread, Datapoint *datapoint, Gradient *g) {
 	int c1 = g->datapoint->GetCoordinates()[0];
 	int c2 = g->datapoint->GetCoordinates()[1];
 	int w2v_length = model->CoordinateSize();
-	std::vector<double> &local_model = model->ModelData();
+	Storage *local_model = Parameters(thread);
+	int stride = ParametersStride();
+	Real coeff = g->coeffs[0];
+	Real learning_rate = FLAGS_learning_rate;
+	if (IsHub(c1) || IsHub(c2)) {
+	    ApplyWordEmbeddingsGradientToHubs(local_model, c1, c2, coeff, learning_rate);
+	    return;
+	}
+	for (int i = 0; i < w2v_length; i++) {
+	    Real value1 = local_model[c1*stride+i];
+	    Real value2 = local_model[c2*stride+i];
+	    Real final_grad = -(2 * coeff * (value1 + value2));
+	    // Reread value2, c1 may equal c2.
+	    local_model[c1*stride+i] = (Storage)(value1 - learning_rate * final_grad);
+	    local_model[c2*stride+i] = (Storage)((Real)local_model[c2*stride+i] - learning_rate * final_grad);
+	}
+    }
+
+    // The same update, adding to the rows of hub coordinates atomically.
+    void ApplyWordEmbeddingsGradientToHubs(Storage *local_model, int c1, int c2, Real coeff, Real learning_rate) {
+	int w2v_length = model->CoordinateSize();
+	int stride = ParametersStride();
+	bool hub1 = IsHub(c1), hub2 = IsHub(c2);
 	for (int i = 0; i < w2v_length; i++) {
-	    double final_grad = -(2 * g->coeffs[0] * (local_model[c1*w2v_length+i] + local_model[c2*w2v_length+i]));
-	    local_model[c1*w2v_length+i] -= FLAGS_learning_rate * final_grad;
-	    local_model[c2*w2v_length+i] -= FLAGS_learning_rate * final_grad;
+	    Storage *value1 = &local_model[c1*stride+i];
+	    Storage *value2 = &local_model[c2*stride+i];
+	    Real step = learning_rate * 2 * coeff * ((Real)*value1 + (Real)*value2);
+	    // Reread value2, c1 may equal c2.
+	    if (hub1) AtomicAdd(value1, step);
+	    else *value1 = (Storage)((Real)*value1 + step);
+	    if (hub2) AtomicAdd(value2, step);
+	    else *value2 = (Storage)((Real)*value2 + step);
 	}
     }
 
     // Note that the Update method is called by many threads.
     // So we have thread local gradients to avoid conflicts.
     void Update(Model *model, Datapoint *datapoint) override {
-	int thread_num = omp_get_thread_num();
-	thread_gradients[thread_num].Clear();
-	thread_gradients[thread_num].datapoint = datapoint;
+	int thread = omp_get_thread_num();
+	Gradient &gradient = thread_gradients.Get(thread);
+	gradient.Clear();
+	gradient.datapoint = datapoint;
 
 	// Prepare and apply gradient.
-	PrepareWordEmbeddingsGradient(datapoint, &thread_gradients[thread_num]);
-	ApplyWordEmbeddingsGradient(datapoint, &thread_gradients[thread_num]);
-
-	// Update bookkeeping.
-	for (const auto &coordinate : datapoint->GetCoordinates()) {
-	    bookkeeping[coordinate] = datapoint->GetOrder();
-	}
+	PrepareWordEmbeddingsGradient(thread, datapoint, &gradient);
+	ApplyWordEmbeddingsGradient(thread, datapoint, &gradient);
     }
 
  public:
     WordEmbeddingsSGDUpdater(Model *model, std::vector<Datapoint *> &datapoints) : SparseSGDUpdater(model, datapoints) {
-	c_sum_mult1.resize(FLAGS_n_threads);
-	c_sum_mult2.resize(FLAGS_n_threads);
-	std::fill(c_sum_mult1.begin(), c_sum_mult1.end(), 0);
-	std::fill(c_sum_mult2.begin(), c_sum_mult2.end(), 0);
+	c_sum_mult1.Initialize(FLAGS_n_threads, 0.0);
+	c_sum_mult2.Initialize(FLAGS_n_threads, 0.0);
     }
 
     ~WordEmbeddingsSGDUpdater() {
     }
 
+    const char *UpdateData(size_t &row_bytes) override {
+	row_bytes = ParametersStride() * sizeof(Storage);
+	if (std::is_same<Storage, double>::value) {
+	    return (const char *)model->ModelData().data();
+	}
+	return (const char *)reduced_model.Data();
+    }
+
+    // Gathered rows are in double.
+    bool CanGatherUpdates() override {
+	return std::is_same<Storage, double>::value && SparseSGDUpdater::CanGatherUpdates();
+    }
+
+    void EpochBegin() override {
+	SparseSGDUpdater::EpochBegin();
+	if (!std::is_same<Storage, double>::value) {
+	    reduced_model.Acquire(model->ModelData(), row_stride, model->CoordinateSize(), FLAGS_n_threads);
+	}
+    }
+
+    void SyncModel() override {
+	if (!std::is_same<Storage, double>::value) {
+	    reduced_model.Sync(model->ModelData(), row_stride, model->CoordinateSize(), FLAGS_n_threads);
+	}
+    }
+
     // Called when the epoch ends.
     virtual void EpochFinish() {
 	SparseSGDUpdater::EpochFinish();
@@ -95,10 +165,10 @@ protected:
 	// Update C based on closed form solution.
 	double C_A = 0, C_B = 0;
 	for (int thread = 0; thread < FLAGS_n_threads; thread++) {
-	    C_A += c_sum_mult1[thread];
-	    C_B += c_sum_mult2[thread];
-	    c_sum_mult1[thread] = 0;
-	    c_sum_mult2[thread] = 0;
+	    C_A += c_sum_mult1.Get(thread);
+	    C_B += c_sum_mult2.Get(thread);
+	    c_sum_mult1.Get(thread) = 0;
+	    c_sum_mult2.Get(thread) = 0;
 	}
 	model->ExtraData()[0] = C_A/C_B;
     }
@@ -87,6 +87,7 @@ DEFINE_int32(n_threads, 2, "Number of threads in parallel during training.");
 DEFINE_double(learning_rate, .001, "Learning rate.");
 DEFINE_bool(print_loss_per_epoch, false, "Should compute and print loss every epoch.");
 DEFINE_bool(print_partition_time, false, "Should print time taken to distribute datapoints across threads.");
+DEFINE_bool(print_epoch_finish_time, false, "Should print time taken by the updater to finish each epoch (e.g: final catch up).");
 
 
 DEFINE_bool(shuffle_datapoints, true, "Shuffle datapoints before training.");
@@ -101,16 +102,23 @@ DEFINE_bool(dense_linear_sgd, false, "Use the dense linear SGD update method.");
 DEFINE_bool(sparse_sgd, false, "Use the sparse SGD update method.");
 DEFINE_bool(svrg, false, "Use the SVRG update method.");
 DEFINE_bool(saga, false, "Use the SAGA update method. Note this assumes gradients are sparse.");
+DEFINE_bool(lazy_saga, false, "Use the SAGA update method with just-in-time catch up of the average gradient, kept correct under hogwild by atomic updates and compare and swap bookkeeping.");
 
 // MISC flags.
 DEFINE_int32(random_range, 100, "Range of random numbers for initializing the model.");
 
+#include "Numa/NumaTopology.h"
+#include "Model/CoordinateCompaction.h"
+#include "Model/CoordinateOrdering.h"
+
 #include "Updater/Updater.h"
 #include "Updater/DenseLinearSGDUpdater.h"
 #include "Updater/SparseSGDUpdater.h"
 #include "Updater/SVRGUpdater.h"
 #include "Updater/SAGAUpdater.h"
+#include "Updater/LazySAGAUpdater.h"
 #include "Updater/FastMCUpdater.h"
+#include "Updater/FastLSUpdater.h"
 #include "Updater/WordEmbeddingsUpdater.h"
 
 #include "Partitioner/CycladesPartitioner.h"
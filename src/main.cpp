@@ -25,6 +25,25 @@ DEFINE_bool(fast_matrix_completion, false, "Matrix completion with custom sgd up
 DEFINE_bool(word_embeddings, false, "W2V application type. Do NOT set an updater (E.G: sparse_sgd) if you want to use the default optimizer which optimizes C.");
 DEFINE_bool(matrix_inverse, false, "Matrix inverse application type.");
 DEFINE_bool(least_squares, false, "Sparse least squares application type.");
+DEFINE_bool(fast_least_squares, false, "Sparse least squares with custom sgd updater, vectorized across conflict free datapoints with the cyclades trainer. Do not specify an extra updater.");
+
+// Run with the updater keeping the model in --model_precision.
+template <class MODEL_CLASS, class DATAPOINT_CLASS, template <class> class UPDATER_CLASS>
+void RunInModelPrecision() {
+    if (FLAGS_model_precision == "double") {
+	Run<MODEL_CLASS, DATAPOINT_CLASS, UPDATER_CLASS<double> >();
+    }
+    else if (FLAGS_model_precision == "float") {
+	Run<MODEL_CLASS, DATAPOINT_CLASS, UPDATER_CLASS<float> >();
+    }
+    else if (FLAGS_model_precision == "bf16") {
+	Run<MODEL_CLASS, DATAPOINT_CLASS, UPDATER_CLASS<bfloat16> >();
+    }
+    else {
+	std::cerr << "Unknown model precision: " << FLAGS_model_precision << std::endl;
+	exit(0);
+    }
+}
 
 int main(int argc, char **argv) {
     gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -32,7 +51,7 @@ int main(int argc, char **argv) {
 	Run<MCModel, MCDatapoint>();
     }
     else if (FLAGS_word_embeddings) {
-	Run<WordEmbeddingsModel, WordEmbeddingsDatapoint, WordEmbeddingsSGDUpdater>();
+	RunInModelPrecision<WordEmbeddingsModel, WordEmbeddingsDatapoint, WordEmbeddingsSGDUpdater>();
     }
     else if (FLAGS_matrix_inverse) {
 	Run<MatrixInverseModel, MatrixInverseDatapoint>();
@@ -41,6 +60,9 @@ int main(int argc, char **argv) {
 	Run<LSModel, LSDatapoint>();
     }
     else if (FLAGS_fast_matrix_completion) {
-	Run<MCModel, MCDatapoint, FastMCSGDUpdater>();
+	RunInModelPrecision<MCModel, MCDatapoint, FastMCSGDUpdater>();
+    }
+    else if (FLAGS_fast_least_squares) {
+	Run<LSModel, LSDatapoint, FastLSSGDUpdater>();
     }
 }
@@ -9,11 +9,18 @@ TrainStatistics RunOnce() {
     DatasetReader::ReadDataset<MODEL_CLASS, DATAPOINT_CLASS>(FLAGS_data_file, datapoints, model);
     model->SetUp(datapoints);
 
+    // Drop unused coordinates, and relabel the rest for locality (undone
+    // after training).
+    CoordinateCompaction coordinate_compaction;
+    coordinate_compaction.Apply(model, datapoints);
+    CoordinateOrdering coordinate_ordering;
+    coordinate_ordering.Apply(model, datapoints);
+
     // Shuffle the datapoints and assign the order.
     if (FLAGS_shuffle_datapoints) {
       std::random_shuffle(datapoints.begin(), datapoints.end());
     }
-    for (int i = 0; i < datapoints.size(); i++) {
+    for (DatapointIndex i = 0; i < datapoints.size(); i++) {
 	datapoints[i]->SetOrder(i+1);
     }
 
@@ -31,6 +38,9 @@ TrainStatistics RunOnce() {
     else if (FLAGS_saga) {
 	updater = new SAGAUpdater(model, datapoints);
     }
+    else if (FLAGS_lazy_saga) {
+	updater = new LazySAGAUpdater(model, datapoints);
+    }
     else {
 	updater = new CUSTOM_UPDATER(model, datapoints);
     }
@@ -50,7 +60,16 @@ TrainStatistics RunOnce() {
 	trainer = new CUSTOM_TRAINER();
     }
 
+    if (FLAGS_print_page_size) {
+	ModelVector &model_data = model->ModelData();
+	printf("Model: %f MB, %s\n", model_data.size() * sizeof(double) / 1e6,
+	       HugePages::DescribePages(model_data.data()).c_str());
+    }
+
     TrainStatistics stats = trainer->Train(model, datapoints, updater);
+    updater->SyncModel();
+    coordinate_ordering.Undo(model, datapoints);
+    coordinate_compaction.Undo(model, datapoints);
 
     // Delete trainer.
     delete trainer;